@@ -7,20 +7,87 @@ void JITVisitor::InitializeModuleAndPassManager() {
   TheModule = std::make_unique<Module>("my cool jit", *TheContext);
   
   Builder = std::make_unique<IRBuilder<>>(*TheContext);
-  
-  InitOptimPassManager();
+  Builder->setFastMathFlags(FP.getFastMathFlags());
   
   TheModule->setDataLayout(TheJIT->getDataLayout());
 }
 
+void JITVisitor::setLazy(bool Enable) {
+  Lazy = Enable;
+  if (!Lazy)
+    return;
+  // Lazily compiled definitions are optimized when they are compiled.
+  TheJIT->setLazyTransform(
+      [this](ThreadSafeModule TSM,
+             MaterializationResponsibility &) -> Expected<ThreadSafeModule> {
+        TSM.withModuleDo([this](Module &M) { TheOptimizer->run(M); });
+        return std::move(TSM);
+      });
+}
+
+void JITVisitor::setTiered(uint64_t Threshold) {
+  Tiering = std::make_unique<TieredCompiler>(*TheJIT, Threshold);
+}
+
+void JITVisitor::runBatch() {
+    if (!Tiering)
+      TheOptimizer->run(*TheModule);
+
+    // One tracker for the whole batch, which frees its memory afterwards.
+    auto RT = TheJIT->getMainJITDylib().createResourceTracker();
+    auto TSM = ThreadSafeModule(std::move(TheModule), std::move(TheContext));
+    ExitOnErr(TheJIT->addModule(std::move(TSM), RT));
+    InitializeModuleAndPassManager();
+
+    auto Thunks = ExitOnErr(TheJIT->lookupAll(Batch));
+    for (auto &Thunk : Thunks) {
+      double (*FP)() = (double (*)())(intptr_t)Thunk.getAddress();
+      double Result = FP();
+      if (PrintResults)
+        fprintf(stderr, "Evaluated to %f\n", Result);
+    }
+    Batch.clear();
+
+    ExitOnErr(RT->remove());
+}
+
+void JITVisitor::flush() {
+    if (!Batch.empty())
+      runBatch();
+}
+
 Function* JITVisitor::visit(FunctionAST& Node){
     
     auto &P =  *(Node.Proto);
+    bool IsAnon = P.getName().str() == "__anon_expr";
+    // Expressions waiting in TheModule run before later definitions are
+    // generated into it.
+    if (!IsAnon)
+      flush();
+    bool Batching = IsAnon && BatchSize > 1;
     auto *FnIR = CodeGenVisitor::visit(Node);
-    if(FnIR)
-        FnIR->print(errs());
+    if(FnIR) {
+        // Every definition lives in a module of its own, so the module
+        // pipeline sees exactly this function.  In lazy mode definitions
+        // are printed unoptimized, as is everything in tiered mode and
+        // batched expressions, which are optimized together.
+        if (!Tiering && !Batching && (!Lazy || IsAnon))
+          TheOptimizer->run(*TheModule);
+        if (PrintIR)
+          FnIR->print(errs());
+    }
+
+    if (Batching) {
+      if (FnIR) {
+        FnIR->setName("__anon_expr." + Twine(NumThunks++));
+        Batch.push_back(FnIR->getName().str());
+      }
+      if (Batch.size() >= BatchSize)
+        runBatch();
+      return FnIR;
+    }
     
-    if (P.getName() == "__anon_expr"){
+    if (IsAnon){
       // Create a ResourceTracker to track JIT'd memory allocated to our
       // anonymous expression -- that way we can free it after executing.
       auto RT = TheJIT->getMainJITDylib().createResourceTracker();
@@ -35,7 +102,9 @@ Function* JITVisitor::visit(FunctionAST& Node){
       // Get the symbol's address and cast it to the right type (takes no
       // arguments, returns a double) so we can call it as a native function.
       double (*FP)() = (double (*)())(intptr_t)ExprSymbol.getAddress();
-      fprintf(stderr, "Evaluated to %f\n", FP());
+      double Result = FP();
+      if (PrintResults)
+        fprintf(stderr, "Evaluated to %f\n", Result);
 
       // Delete the anonymous expression module from the JIT.
       ExitOnErr(RT->remove());
@@ -43,8 +112,12 @@ Function* JITVisitor::visit(FunctionAST& Node){
       return FnIR;   
     }
     
-    ExitOnErr(TheJIT->addModule(
-          ThreadSafeModule(std::move(TheModule), std::move(TheContext))));
+    auto TSM = ThreadSafeModule(std::move(TheModule), std::move(TheContext));
+    if (Tiering && FnIR)
+      ExitOnErr(Tiering->addDefinition(std::move(TSM), P.getName().str()));
+    else
+      ExitOnErr(Lazy ? TheJIT->addLazyModule(std::move(TSM))
+                     : TheJIT->addModule(std::move(TSM)));
     InitializeModuleAndPassManager();
 
     return FnIR;
@@ -0,0 +1,198 @@
+#include "../include/jitmemory.h"
+#include "llvm/Support/Alignment.h"
+#include "llvm/Support/Process.h"
+
+#include <algorithm>
+
+using namespace llvm;
+
+JITMemoryPool::JITMemoryPool()
+    : PageSize(sys::Process::getPageSizeEstimate()) {}
+
+JITMemoryPool::~JITMemoryPool() {
+  for (sys::MemoryBlock &Slab : Slabs)
+    sys::Memory::releaseMappedMemory(Slab);
+}
+
+/// getClass - The size class of blocks of Pages pages, NumClasses if they
+/// are too big to pool.
+unsigned JITMemoryPool::getClass(size_t Pages) const {
+  unsigned Class = Log2_64_Ceil(Pages);
+  return Class < NumClasses ? Class : NumClasses;
+}
+
+/// carve - Size fresh read-write bytes from the current slab, or from a new
+/// one.  What is left of the old slab stays unused.
+uint8_t *JITMemoryPool::carve(size_t Size, std::error_code &EC) {
+  if (SlabNext && (size_t)(SlabEnd - SlabNext) >= Size) {
+    uint8_t *Addr = SlabNext;
+    SlabNext += Size;
+    return Addr;
+  }
+  sys::MemoryBlock Slab = sys::Memory::allocateMappedMemory(
+      Size > SlabSize ? Size : SlabSize, nullptr,
+      sys::Memory::MF_READ | sys::Memory::MF_WRITE, EC);
+  if (EC)
+    return nullptr;
+  Slabs.push_back(Slab);
+  Counters.MappedBytes += Slab.allocatedSize();
+  uint8_t *Addr = static_cast<uint8_t *>(Slab.base());
+  SlabNext = Addr + Size;
+  SlabEnd = Addr + Slab.allocatedSize();
+  return Addr;
+}
+
+Expected<JITMemoryPool::Block> JITMemoryPool::allocate(size_t Size, Kind K) {
+  size_t Pages = std::max<size_t>(divideCeil(Size, PageSize), 1);
+  unsigned Class = getClass(Pages);
+  if (Class < NumClasses)
+    Pages = size_t(1) << Class;
+
+  std::lock_guard<std::mutex> Lock(Mutex);
+  Block B;
+  std::vector<Block> *FreeList =
+      Class < NumClasses ? &FreeLists[K][Class] : nullptr;
+  if (FreeList && !FreeList->empty()) {
+    B = FreeList->back();
+    FreeList->pop_back();
+    ++Counters.Reuses;
+    if (B.Protected) {
+      sys::MemoryBlock MB(B.Addr, B.Size);
+      if (std::error_code EC = sys::Memory::protectMappedMemory(
+              MB, sys::Memory::MF_READ | sys::Memory::MF_WRITE)) {
+        FreeList->push_back(B);
+        return errorCodeToError(EC);
+      }
+      ++Counters.Protections;
+      B.Protected = false;
+    }
+  } else {
+    std::error_code EC;
+    B.Size = Pages * PageSize;
+    B.Addr = carve(B.Size, EC);
+    if (!B.Addr)
+      return errorCodeToError(EC);
+    B.K = K;
+  }
+
+  ++Counters.Allocations;
+  Counters.InUseBytes += B.Size;
+  Counters.PeakInUseBytes =
+      std::max(Counters.PeakInUseBytes, Counters.InUseBytes);
+  return B;
+}
+
+void JITMemoryPool::release(Block B) {
+  std::lock_guard<std::mutex> Lock(Mutex);
+  Counters.InUseBytes -= B.Size;
+  // Blocks too big to pool were carved from a slab of their own, which
+  // stays mapped like the others.
+  unsigned Class = getClass(B.Size / PageSize);
+  if (Class < NumClasses)
+    FreeLists[B.K][Class].push_back(B);
+}
+
+std::error_code JITMemoryPool::protect(Block &B) {
+  assert(B.K != Data && "data stays read-write");
+  sys::MemoryBlock MB(B.Addr, B.Size);
+  unsigned Flags = sys::Memory::MF_READ;
+  if (B.K == Code)
+    Flags |= sys::Memory::MF_EXEC;
+  if (std::error_code EC = sys::Memory::protectMappedMemory(MB, Flags))
+    return EC;
+  if (B.K == Code)
+    sys::Memory::InvalidateInstructionCache(B.Addr, B.Size);
+  B.Protected = true;
+  std::lock_guard<std::mutex> Lock(Mutex);
+  ++Counters.Protections;
+  return std::error_code();
+}
+
+void JITMemoryPool::printStats(raw_ostream &OS) const {
+  std::lock_guard<std::mutex> Lock(Mutex);
+  OS << "JIT memory: " << Counters.MappedBytes << " bytes mapped, "
+     << Counters.InUseBytes << " in use (peak " << Counters.PeakInUseBytes
+     << "), " << Counters.Allocations << " allocations, " << Counters.Reuses
+     << " reused, " << Counters.Protections << " protection changes\n";
+}
+
+PooledMemoryManager::~PooledMemoryManager() {
+  for (JITMemoryPool::Block &B : Blocks)
+    Pool.release(B);
+}
+
+/// grow - Start a new block of K with room for at least Size bytes.
+bool PooledMemoryManager::grow(uintptr_t Size, JITMemoryPool::Kind K) {
+  auto B = Pool.allocate(Size, K);
+  if (!B) {
+    if (AllocError.empty())
+      AllocError = toString(B.takeError());
+    else
+      consumeError(B.takeError());
+    return false;
+  }
+  Blocks.push_back(*B);
+  Regions[K].Next = B->Addr;
+  Regions[K].End = B->Addr + B->Size;
+  return true;
+}
+
+uint8_t *PooledMemoryManager::allocate(uintptr_t Size, unsigned Alignment,
+                                       JITMemoryPool::Kind K) {
+  Align A(std::max(Alignment, 1u));
+  Region &R = Regions[K];
+  uint8_t *Addr = R.Next ? (uint8_t *)alignAddr(R.Next, A) : nullptr;
+  if (!Addr || Addr + Size > R.End) {
+    if (!grow(Size + A.value() - 1, K))
+      return nullptr;
+    Addr = (uint8_t *)alignAddr(R.Next, A);
+  }
+  R.Next = Addr + Size;
+  return Addr;
+}
+
+void PooledMemoryManager::reserveAllocationSpace(
+    uintptr_t CodeSize, uint32_t CodeAlign, uintptr_t RODataSize,
+    uint32_t RODataAlign, uintptr_t RWDataSize, uint32_t RWDataAlign) {
+  // Each size may need its alignment's worth of padding in front.
+  if (CodeSize)
+    grow(CodeSize + CodeAlign, JITMemoryPool::Code);
+  if (RODataSize)
+    grow(RODataSize + RODataAlign, JITMemoryPool::ROData);
+  if (RWDataSize)
+    grow(RWDataSize + RWDataAlign, JITMemoryPool::Data);
+}
+
+uint8_t *PooledMemoryManager::allocateCodeSection(uintptr_t Size,
+                                                  unsigned Alignment,
+                                                  unsigned SectionID,
+                                                  StringRef SectionName) {
+  return allocate(Size, Alignment, JITMemoryPool::Code);
+}
+
+uint8_t *PooledMemoryManager::allocateDataSection(uintptr_t Size,
+                                                  unsigned Alignment,
+                                                  unsigned SectionID,
+                                                  StringRef SectionName,
+                                                  bool IsReadOnly) {
+  return allocate(Size, Alignment,
+                  IsReadOnly ? JITMemoryPool::ROData : JITMemoryPool::Data);
+}
+
+bool PooledMemoryManager::finalizeMemory(std::string *ErrMsg) {
+  if (!AllocError.empty()) {
+    if (ErrMsg)
+      *ErrMsg = AllocError;
+    return true;
+  }
+  for (JITMemoryPool::Block &B : Blocks) {
+    if (B.K == JITMemoryPool::Data || B.Protected)
+      continue;
+    if (std::error_code EC = Pool.protect(B)) {
+      if (ErrMsg)
+        *ErrMsg = EC.message();
+      return true;
+    }
+  }
+  return false;
+}
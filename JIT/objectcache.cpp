@@ -0,0 +1,174 @@
+#include "../include/objectcache.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Bitcode/BitcodeWriter.h"
+#include "llvm/Support/Chrono.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Process.h"
+#include "llvm/Support/SHA1.h"
+
+#include <utility>
+
+using namespace llvm;
+
+Expected<std::unique_ptr<DiskObjectCache>>
+DiskObjectCache::create(StringRef Dir, uint64_t MaxBytes, StringRef Salt) {
+  if (std::error_code EC = sys::fs::create_directories(Dir))
+    return createFileError(Dir, EC);
+  std::unique_ptr<DiskObjectCache> Cache(
+      new DiskObjectCache(Dir, MaxBytes, Salt));
+  if (Error Err = Cache->scan())
+    return std::move(Err);
+  // The limit may be lower than in the session that filled the directory.
+  Cache->evict();
+  return std::move(Cache);
+}
+
+std::string DiskObjectCache::getKey(const Module &M) const {
+  SmallVector<char, 0> Bitcode;
+  raw_svector_ostream OS(Bitcode);
+  WriteBitcodeToFile(M, OS);
+
+  SHA1 Hasher;
+  Hasher.update(Salt);
+  Hasher.update(StringRef("\0", 1));
+  Hasher.update(StringRef(Bitcode.data(), Bitcode.size()));
+  return toHex(Hasher.final(), /*LowerCase=*/true);
+}
+
+std::string DiskObjectCache::getPath(StringRef Key) const {
+  SmallString<128> Path(Dir);
+  sys::path::append(Path, Key + ".o");
+  return std::string(Path.str());
+}
+
+/// scan - Index the objects already in the directory, oldest first.
+Error DiskObjectCache::scan() {
+  SmallVector<std::pair<sys::TimePoint<>, Entry>, 0> Found;
+  std::error_code EC;
+  for (sys::fs::directory_iterator I(Dir, EC), E; I != E && !EC;
+       I.increment(EC)) {
+    StringRef Name = sys::path::filename(I->path());
+    if (!Name.endswith(".o"))
+      continue;
+    auto Status = I->status();
+    if (!Status)
+      continue;
+    Found.push_back({Status->getLastModificationTime(),
+                     {Name.drop_back(2).str(), Status->getSize()}});
+  }
+  if (EC)
+    return createFileError(Dir, EC);
+
+  llvm::sort(Found, [](const std::pair<sys::TimePoint<>, Entry> &A,
+                       const std::pair<sys::TimePoint<>, Entry> &B) {
+    return A.first < B.first;
+  });
+  for (auto &F : Found)
+    insert(F.second.Key, F.second.Size);
+  return Error::success();
+}
+
+void DiskObjectCache::insert(StringRef Key, uint64_t Size) {
+  LRU.push_back({Key.str(), Size});
+  Index[Key] = std::prev(LRU.end());
+  TotalBytes += Size;
+}
+
+/// evict - Delete least recently used objects until the rest fit.  The
+/// newest one is always kept.
+void DiskObjectCache::evict() {
+  while (TotalBytes > MaxBytes && LRU.size() > 1) {
+    Entry &Victim = LRU.front();
+    sys::fs::remove(getPath(Victim.Key));
+    TotalBytes -= Victim.Size;
+    Index.erase(Victim.Key);
+    LRU.pop_front();
+    ++Counters.Evictions;
+  }
+}
+
+/// holdsOnlyThunks - Whether M defines nothing but the thunks of top level
+/// expressions, which run once and are thrown away.
+static bool holdsOnlyThunks(const Module &M) {
+  for (const Function &F : M)
+    if (!F.isDeclaration() && !F.getName().startswith("__anon_expr"))
+      return false;
+  return true;
+}
+
+std::unique_ptr<MemoryBuffer> DiskObjectCache::getObject(const Module *M) {
+  if (holdsOnlyThunks(*M))
+    return nullptr;
+  std::string Key = getKey(*M);
+  std::lock_guard<std::mutex> Lock(Mutex);
+
+  auto I = Index.find(Key);
+  if (I != Index.end()) {
+    std::string Path = getPath(Key);
+    if (auto Buf = MemoryBuffer::getFile(Path)) {
+      ++Counters.Hits;
+      LRU.splice(LRU.end(), LRU, I->second);
+      // Record the use for later sessions.
+      int FD;
+      if (!sys::fs::openFileForRead(Path, FD)) {
+        sys::fs::setLastAccessAndModificationTime(
+            FD, std::chrono::system_clock::now());
+        sys::Process::SafelyCloseFileDescriptor(FD);
+      }
+      return std::move(*Buf);
+    }
+    // Another session evicted it.
+    TotalBytes -= I->second->Size;
+    LRU.erase(I->second);
+    Index.erase(I);
+  }
+
+  ++Counters.Misses;
+  return nullptr;
+}
+
+void DiskObjectCache::notifyObjectCompiled(const Module *M,
+                                           MemoryBufferRef Obj) {
+  if (holdsOnlyThunks(*M))
+    return;
+  // The module is hashed again rather than remembered from getObject: a
+  // module whose compilation failed never gets here, and another module may
+  // later be allocated at its address.
+  std::string Key = getKey(*M);
+  std::lock_guard<std::mutex> Lock(Mutex);
+  if (Index.count(Key))
+    return;
+
+  // Write under a temporary name and rename, so that no session ever reads
+  // a partial object.  Failing to cache is not an error.
+  SmallString<128> TmpPath;
+  int FD;
+  if (sys::fs::createUniqueFile(Dir + "/tmp-%%%%%%%%", FD, TmpPath))
+    return;
+  raw_fd_ostream OS(FD, /*shouldClose=*/true);
+  OS << Obj.getBuffer();
+  OS.close();
+  if (OS.has_error()) {
+    OS.clear_error();
+    sys::fs::remove(TmpPath);
+    return;
+  }
+  if (sys::fs::rename(TmpPath, getPath(Key))) {
+    sys::fs::remove(TmpPath);
+    return;
+  }
+
+  insert(Key, Obj.getBufferSize());
+  evict();
+}
+
+void DiskObjectCache::printStats(raw_ostream &OS) const {
+  std::lock_guard<std::mutex> Lock(Mutex);
+  OS << "object cache: " << Counters.Hits << " hits, " << Counters.Misses
+     << " misses, " << Counters.Evictions << " evictions, " << LRU.size()
+     << " objects (" << TotalBytes << " bytes)\n";
+}
@@ -0,0 +1,164 @@
+#include "../include/tiering.h"
+#include "llvm/ADT/SetVector.h"
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+
+using namespace llvm;
+using namespace llvm::orc;
+
+/// TierUpHook - What tier 0 code calls when it gets hot.
+static const char *const TierUpHook = "__kaleidoscope_tier_up";
+
+TieredCompiler::TieredCompiler(KaleidoscopeJIT &JIT, uint64_t Threshold)
+    : JIT(JIT), Stubs(JIT.createIndirectStubsManager()),
+      Threshold(Threshold), HotOptimizer(3, &JIT.getTargetMachine()) {
+  cantFail(JIT.defineAbsolute(
+      TierUpHook, JITEvaluatedSymbol(pointerToJITTargetAddress(&tierUp),
+                                     JITSymbolFlags::Exported)));
+  Worker = std::thread([this] { runWorker(); });
+}
+
+TieredCompiler::~TieredCompiler() {
+  {
+    std::lock_guard<std::mutex> Lock(QueueMutex);
+    Stopping = true;
+  }
+  QueueChanged.notify_one();
+  Worker.join();
+}
+
+void TieredCompiler::tierUp(TieredFunction *TF) {
+  TieredCompiler &TC = *TF->Owner;
+  {
+    std::lock_guard<std::mutex> Lock(TC.QueueMutex);
+    TC.Queue.push_back(TF);
+  }
+  TC.QueueChanged.notify_one();
+}
+
+void TieredCompiler::runWorker() {
+  while (true) {
+    TieredFunction *TF;
+    {
+      std::unique_lock<std::mutex> Lock(QueueMutex);
+      QueueChanged.wait(Lock, [this] { return Stopping || !Queue.empty(); });
+      if (Stopping)
+        return;
+      TF = Queue.front();
+      Queue.pop_front();
+    }
+    recompile(*TF);
+  }
+}
+
+void TieredCompiler::recompile(TieredFunction &TF) {
+  // The module shares its context with tier 0 code, whose compilation
+  // holds the context lock, as does withModuleDo.
+  TF.Hot.withModuleDo([this](Module &M) { HotOptimizer.run(M); });
+
+  auto Report = [&](Error Err) {
+    logAllUnhandledErrors(std::move(Err), errs(),
+                          "tier up of '" + TF.Name + "' failed: ");
+  };
+  if (auto Err = JIT.addModule(std::move(TF.Hot)))
+    return Report(std::move(Err));
+  auto Sym = JIT.lookup(TF.Name + ".tier1");
+  if (!Sym)
+    return Report(Sym.takeError());
+  if (auto Err = Stubs->updatePointer(TF.Name, Sym->getAddress()))
+    return Report(std::move(Err));
+}
+
+/// instrument - Count the entries of F and the iterations of its loops,
+/// and let TF tier up when the count reaches the threshold.
+void TieredCompiler::instrument(Function &F, TieredFunction &TF) {
+  Module &M = *F.getParent();
+  LLVMContext &Ctx = M.getContext();
+  Type *Int64Ty = Type::getInt64Ty(Ctx);
+  auto *Counter = new GlobalVariable(M, Int64Ty, false,
+                                     GlobalValue::InternalLinkage,
+                                     ConstantInt::get(Int64Ty, 0),
+                                     TF.Name + ".count");
+  FunctionCallee Hook = M.getOrInsertFunction(
+      TierUpHook, Type::getVoidTy(Ctx), Type::getInt8PtrTy(Ctx));
+  // TF is reached through a symbol rather than a constant address, so that
+  // the module is the same in every session and its object can be cached.
+  Constant *Arg = M.getOrInsertGlobal(TF.Name + ".state", Type::getInt8Ty(Ctx));
+  MDNode *Unlikely = MDBuilder(Ctx).createBranchWeights(1, 1u << 20);
+
+  // Count at the entry and at the header of every loop, i.e. at the
+  // target of every back edge.
+  SetVector<BasicBlock *> Points;
+  Points.insert(&F.getEntryBlock());
+  DominatorTree DT(F);
+  for (BasicBlock &BB : F)
+    for (BasicBlock *Succ : successors(&BB))
+      if (DT.dominates(Succ, &BB))
+        Points.insert(Succ);
+
+  for (BasicBlock *BB : Points) {
+    BasicBlock::iterator IP = BB->getFirstInsertionPt();
+    while (isa<AllocaInst>(IP))
+      ++IP;
+    IRBuilder<> Builder(&*IP);
+    Value *Count = Builder.CreateAdd(Builder.CreateLoad(Int64Ty, Counter),
+                                     Builder.getInt64(1), "count");
+    Builder.CreateStore(Count, Counter);
+    Value *Hot = Builder.CreateICmpEQ(Count, Builder.getInt64(Threshold),
+                                      "hot");
+    Instruction *Then = SplitBlockAndInsertIfThen(Hot, &*IP, false, Unlikely);
+    IRBuilder<>(Then).CreateCall(Hook, Arg);
+  }
+}
+
+Error TieredCompiler::addDefinition(ThreadSafeModule TSM, StringRef Name) {
+  Functions.push_back(std::make_unique<TieredFunction>());
+  TieredFunction &TF = *Functions.back();
+  TF.Owner = this;
+  TF.Name = Name.str();
+
+  TSM.withModuleDo([&](Module &M) {
+    Function *F = M.getFunction(Name);
+
+    // Tier 1 starts from the unoptimized code.  Its self calls stay direct
+    // so that they can be inlined or turned into loops.
+    std::unique_ptr<Module> Hot = CloneModule(M);
+    Hot->getFunction(Name)->setName(Name + ".tier1");
+    TF.Hot = ThreadSafeModule(std::move(Hot), TSM.getContext());
+
+    // Tier 0 calls itself through the stub, so that deep recursion moves
+    // to tier 1 too.  The counter is memory it touches, so it is not
+    // readnone, whatever its callers are told.
+    F->setName(Name + ".tier0");
+    Function *Self = Function::Create(F->getFunctionType(),
+                                      GlobalValue::ExternalLinkage, Name, &M);
+    Self->copyAttributesFrom(F);
+    F->replaceAllUsesWith(Self);
+    F->removeFnAttr(Attribute::ReadNone);
+    F->addFnAttr(Attribute::OptimizeNone);
+    F->addFnAttr(Attribute::NoInline);
+    instrument(*F, TF);
+  });
+
+  // The stub must exist before tier 0 code that calls it is linked.
+  if (auto Err = Stubs->createStub(TF.Name, 0, JITSymbolFlags::Exported))
+    return Err;
+  if (auto Err = JIT.defineAbsolute(TF.Name, Stubs->findStub(TF.Name, true)))
+    return Err;
+  if (auto Err = JIT.defineAbsolute(
+          TF.Name + ".state",
+          JITEvaluatedSymbol(pointerToJITTargetAddress(&TF),
+                             JITSymbolFlags::Exported)))
+    return Err;
+  if (auto Err = JIT.addModule(std::move(TSM)))
+    return Err;
+  auto Sym = JIT.lookup(TF.Name + ".tier0");
+  if (!Sym)
+    return Sym.takeError();
+  return Stubs->updatePointer(TF.Name, Sym->getAddress());
+}
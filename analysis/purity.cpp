@@ -0,0 +1,114 @@
+#include "../include/purity.h"
+#include "../include/typeinference.h"
+#include "llvm/Support/Casting.h"
+#include "llvm/Support/ErrorHandling.h"
+
+#include <string>
+
+using namespace llvm;
+
+namespace {
+/// EffectScan - Accumulates the effects of the expressions of one
+/// definition.
+struct EffectScan {
+  const PurityAnalysis &Analysis;
+  StringRef Self;
+  bool Pure = true;
+  bool WillReturn = true;
+
+  void call(StringRef Callee) {
+    if (Callee == Self) {
+      // Pure if everything else is; the recursion may not end.
+      WillReturn = false;
+      return;
+    }
+    PurityAnalysis::Effects E = Analysis.getEffects(Callee);
+    Pure &= E.Pure;
+    WillReturn &= E.WillReturn;
+  }
+
+  void scan(ExprAST *E);
+};
+} // end anonymous namespace
+
+void EffectScan::scan(ExprAST *E) {
+  if (!E)
+    return;
+  switch (E->getKind()) {
+  case ExprAST::EK_Number:
+  case ExprAST::EK_Variable:
+    return;
+  case ExprAST::EK_Unary: {
+    auto *U = cast<UnaryExprAST>(E);
+    if (!isBuiltinUnaryOp(U->Opcode))
+      call(std::string("unary") + U->Opcode);
+    scan(U->Operand);
+    return;
+  }
+  case ExprAST::EK_Binary: {
+    // Assignments only write the function's own variables.  Left operands
+    // are followed in a loop so that long chains like a + b + c do not
+    // recurse once per operator.
+    auto *B = cast<BinaryExprAST>(E);
+    for (;;) {
+      if (B->Op != '=' && !isPureBinaryOp(B->Op))
+        call(std::string("binary") + B->Op);
+      scan(B->RHS);
+      auto *L = dyn_cast<BinaryExprAST>(B->LHS);
+      if (!L) {
+        scan(B->LHS);
+        return;
+      }
+      B = L;
+    }
+  }
+  case ExprAST::EK_Call: {
+    auto *C = cast<CallExprAST>(E);
+    call(C->Callee.str());
+    for (ExprAST *Arg : C->Args)
+      scan(Arg);
+    return;
+  }
+  case ExprAST::EK_If: {
+    auto *I = cast<IfExprAST>(E);
+    scan(I->Cond);
+    scan(I->Then);
+    scan(I->Else);
+    return;
+  }
+  case ExprAST::EK_For: {
+    // Code generation gives counted loops an integer counter with a bounded
+    // trip count; any other loop may run forever.
+    auto *F = cast<ForExprAST>(E);
+    int64_t Start, Step;
+    ExprAST *Bound;
+    if (!matchCountedLoop(*F, Start, Step, Bound))
+      WillReturn = false;
+    scan(F->Start);
+    scan(F->End);
+    scan(F->Step);
+    scan(F->Body);
+    return;
+  }
+  case ExprAST::EK_Var: {
+    auto *V = cast<VarExprAST>(E);
+    for (auto &Var : V->VarNames)
+      scan(Var.second);
+    scan(V->Body);
+    return;
+  }
+  }
+  llvm_unreachable("unknown expression kind");
+}
+
+PurityAnalysis::Effects PurityAnalysis::analyze(const PrototypeAST &Proto,
+                                                ExprAST *Body) {
+  EffectScan Scan{*this, Proto.getName().str()};
+  Scan.scan(Body);
+
+  Effects Result;
+  Result.Pure = Scan.Pure;
+  Result.WillReturn = Scan.Pure && Scan.WillReturn;
+  Summaries[Proto.getName().str()] = Result;
+  return Result;
+}
@@ -0,0 +1,321 @@
+#include "../include/typeinference.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/Support/Casting.h"
+#include "llvm/Support/ErrorHandling.h"
+
+#include <algorithm>
+#include <cmath>
+
+using namespace llvm;
+
+bool isAssigned(ExprAST *E, Symbol Name) {
+  if (!E)
+    return false;
+  switch (E->getKind()) {
+  case ExprAST::EK_Number:
+  case ExprAST::EK_Variable:
+    return false;
+  case ExprAST::EK_Unary:
+    return isAssigned(cast<UnaryExprAST>(E)->Operand, Name);
+  case ExprAST::EK_Binary: {
+    // Follow the left operands of a chain like a + b + c in a loop, so that
+    // long chains do not recurse once per operator.
+    auto *B = cast<BinaryExprAST>(E);
+    for (;;) {
+      if (B->Op == '=')
+        if (auto *V = dyn_cast<VariableExprAST>(B->LHS))
+          if (V->Name == Name)
+            return true;
+      if (isAssigned(B->RHS, Name))
+        return true;
+      auto *L = dyn_cast<BinaryExprAST>(B->LHS);
+      if (!L)
+        return isAssigned(B->LHS, Name);
+      B = L;
+    }
+  }
+  case ExprAST::EK_Call:
+    return llvm::any_of(cast<CallExprAST>(E)->Args,
+                        [&](ExprAST *Arg) { return isAssigned(Arg, Name); });
+  case ExprAST::EK_If: {
+    auto *I = cast<IfExprAST>(E);
+    return isAssigned(I->Cond, Name) || isAssigned(I->Then, Name) ||
+           isAssigned(I->Else, Name);
+  }
+  case ExprAST::EK_For: {
+    auto *F = cast<ForExprAST>(E);
+    return isAssigned(F->Start, Name) || isAssigned(F->End, Name) ||
+           isAssigned(F->Step, Name) || isAssigned(F->Body, Name);
+  }
+  case ExprAST::EK_Var: {
+    auto *V = cast<VarExprAST>(E);
+    for (auto &Var : V->VarNames)
+      if (isAssigned(Var.second, Name))
+        return true;
+    return isAssigned(V->Body, Name);
+  }
+  }
+  llvm_unreachable("unknown expression kind");
+}
+
+/// isLoopInvariant - Whether E is pure and reads neither the induction
+/// variable IV nor any variable Body assigns to, so evaluating it once before
+/// the loop gives the value of every evaluation inside it.
+static bool isLoopInvariant(ExprAST *E, Symbol IV, ExprAST *Body) {
+  // Left operands are followed in a loop, right ones recursively.
+  while (auto *B = dyn_cast<BinaryExprAST>(E)) {
+    if (!isPureBinaryOp(B->Op) || !isLoopInvariant(B->RHS, IV, Body))
+      return false;
+    E = B->LHS;
+  }
+  if (isa<NumberExprAST>(E))
+    return true;
+  if (auto *V = dyn_cast<VariableExprAST>(E))
+    return V->Name != IV && !isAssigned(Body, V->Name);
+  return false;
+}
+
+/// getIntegral - If E is an integral literal of magnitude at most 2^53, so
+/// that every double step from it is exact, set Val to it.  -0.0 is not one:
+/// an integer cannot carry its sign.
+static bool getIntegral(ExprAST *E, int64_t &Val) {
+  auto *N = dyn_cast_or_null<NumberExprAST>(E);
+  if (!N || std::trunc(N->Val) != N->Val || std::fabs(N->Val) > 0x1p53 ||
+      (N->Val == 0.0 && std::signbit(N->Val)))
+    return false;
+  Val = (int64_t)N->Val;
+  return true;
+}
+
+bool matchCountedLoop(ForExprAST &Node, int64_t &Start, int64_t &Step,
+                      ExprAST *&Bound) {
+  auto *Cond = dyn_cast<BinaryExprAST>(Node.End);
+  auto *CondVar = Cond ? dyn_cast<VariableExprAST>(Cond->LHS) : nullptr;
+  Step = 1;
+  if (!getIntegral(Node.Start, Start) ||
+      (Node.Step && !getIntegral(Node.Step, Step)) || Step <= 0 ||
+      !CondVar || Cond->Op != '<' || CondVar->Name != Node.VarName ||
+      !isLoopInvariant(Cond->RHS, Node.VarName, Node.Body) ||
+      isAssigned(Node.Body, Node.VarName))
+    return false;
+  Bound = Cond->RHS;
+  return true;
+}
+
+/// MinUnboundedTrips - Iterations a counted loop with an unknown bound must
+/// take to count past 2^53 before its induction variable may be an integer.
+static constexpr double MinUnboundedTrips = 0x1p48;
+
+TypeInference::TypeInfo TypeInference::TypeInfo::getInt(double Lo, double Hi) {
+  // Rounding is monotonic, so a bound that overflowed the exact range while
+  // being computed still compares >= 2^53 here.
+  if (!(std::fabs(Lo) < MaxExact && std::fabs(Hi) < MaxExact))
+    return getDouble();
+  return {TK_Int, Lo, Hi};
+}
+
+/// join - The most precise type that describes values of both A and B.
+static TypeInference::TypeInfo join(TypeInference::TypeInfo A,
+                                    TypeInference::TypeInfo B) {
+  using TI = TypeInference::TypeInfo;
+  if (!A.isIntegral() || !B.isIntegral())
+    return TI::getDouble();
+  if (A.Kind == TypeInference::TK_Bool && B.Kind == TypeInference::TK_Bool)
+    return TI::getBool();
+  return TI::getInt(std::min(A.Lo, B.Lo), std::max(A.Hi, B.Hi));
+}
+
+TypeInference::TypeInfo TypeInference::infer(ExprAST *E) {
+  E->accept(*this);
+  return Result;
+}
+
+void TypeInference::setResult(ExprAST &E, TypeInfo T) {
+  auto Ins = Types.insert({&E, T});
+  if (!Ins.second) {
+    T = join(Ins.first->second, T);
+    if (T != Ins.first->second) {
+      Ins.first->second = T;
+      Changed = true;
+    }
+  }
+  Result = T;
+}
+
+void TypeInference::bind(const void *Key, Symbol Name, TypeInfo T) {
+  auto Ins = Bindings.insert({Key, T});
+  if (!Ins.second && Ins.first->second != T) {
+    Ins.first->second = T;
+    Changed = true;
+  }
+  Scope.insert(Name, T);
+}
+
+void TypeInference::run(ExprAST *Body) {
+  Types.clear();
+  Bindings.clear();
+  // A node shared between contexts can widen after its users were typed,
+  // so iterate until nothing changes.  Types only ever widen.
+  do {
+    Changed = false;
+    infer(Body);
+  } while (Changed);
+}
+
+TypeInference::TypeKind TypeInference::getType(ExprAST *E) const {
+  auto I = Types.find(E);
+  return I == Types.end() ? TK_Double : I->second.Kind;
+}
+
+TypeInference::TypeKind
+TypeInference::getBindingType(const void *Key) const {
+  auto I = Bindings.find(Key);
+  return I == Bindings.end() ? TK_Double : I->second.Kind;
+}
+
+Value *TypeInference::visit(NumberExprAST &Node) {
+  double V = Node.Val;
+  // An integer cannot carry the sign of -0.0.
+  bool Integral = std::trunc(V) == V && !(V == 0.0 && std::signbit(V));
+  setResult(Node, Integral ? TypeInfo::getInt(V, V) : TypeInfo::getDouble());
+  return nullptr;
+}
+
+Value *TypeInference::visit(VariableExprAST &Node) {
+  // Parameters are not in Scope and come back as doubles.
+  setResult(Node, Scope.lookup(Node.Name));
+  return nullptr;
+}
+
+Value *TypeInference::visit(UnaryExprAST &Node) {
+  infer(Node.Operand);
+  setResult(Node, isBuiltinUnaryOp(Node.Opcode) ? TypeInfo::getBool()
+                                                 : TypeInfo::getDouble());
+  return nullptr;
+}
+
+/// typeBinary - The type of the builtin or user operator Op applied to
+/// operands of types L and R.
+static TypeInference::TypeInfo typeBinary(char Op,
+                                          TypeInference::TypeInfo L,
+                                          TypeInference::TypeInfo R) {
+  using TI = TypeInference::TypeInfo;
+  if (!isPureBinaryOp(Op))
+    return TI::getDouble();
+  if (isComparisonOp(Op) || isLogicalOp(Op))
+    return TI::getBool();
+  // Integer division is not exact.
+  if (Op == '/' || !L.isIntegral() || !R.isIntegral())
+    return TI::getDouble();
+
+  // Integer results are never -0.0.  Sums and differences of values that
+  // are not -0.0 cannot be -0.0 either, but 0 * -1 is.
+  switch (Op) {
+  case '+':
+    return TI::getInt(L.Lo + R.Lo, L.Hi + R.Hi);
+  case '-':
+    return TI::getInt(L.Lo - R.Hi, L.Hi - R.Lo);
+  case '*': {
+    bool LZero = L.Lo <= 0 && L.Hi >= 0, RZero = R.Lo <= 0 && R.Hi >= 0;
+    if ((LZero && R.Lo < 0) || (RZero && L.Lo < 0))
+      return TI::getDouble();
+    double P[] = {L.Lo * R.Lo, L.Lo * R.Hi, L.Hi * R.Lo, L.Hi * R.Hi};
+    return TI::getInt(*std::min_element(std::begin(P), std::end(P)),
+                      *std::max_element(std::begin(P), std::end(P)));
+  }
+  default:
+    llvm_unreachable("unknown builtin operator");
+  }
+}
+
+Value *TypeInference::visit(BinaryExprAST &Node) {
+  if (Node.Op == '=') {
+    infer(Node.RHS);
+    setResult(Node, TypeInfo::getDouble());
+    return nullptr;
+  }
+
+  // Type a left-deep chain like a + b + c bottom up in a loop rather than
+  // recursing once per operator.
+  SmallVector<BinaryExprAST *, 8> Spine = {&Node};
+  while (auto *B = dyn_cast<BinaryExprAST>(Spine.back()->LHS)) {
+    if (B->Op == '=')
+      break;
+    Spine.push_back(B);
+  }
+  TypeInfo L = infer(Spine.back()->LHS);
+  for (BinaryExprAST *B : reverse(Spine)) {
+    TypeInfo R = infer(B->RHS);
+    setResult(*B, typeBinary(B->Op, L, R));
+    L = Result;
+  }
+  return nullptr;
+}
+
+Value *TypeInference::visit(CallExprAST &Node) {
+  for (ExprAST *Arg : Node.Args)
+    infer(Arg);
+  setResult(Node, TypeInfo::getDouble());
+  return nullptr;
+}
+
+Value *TypeInference::visit(IfExprAST &Node) {
+  infer(Node.Cond);
+  TypeInfo Then = infer(Node.Then);
+  TypeInfo Else = infer(Node.Else);
+  setResult(Node, join(Then, Else));
+  return nullptr;
+}
+
+Value *TypeInference::visit(ForExprAST &Node) {
+  infer(Node.Start);
+
+  // The induction variable of a counted loop takes the values Start,
+  // Start+Step, ... up to the first one that is not below the bound, and
+  // is an integer while they all stay below 2^53.  With a constant bound
+  // that is the last value.  An unknown bound is only taken to be below
+  // 2^53 when counting that far takes at least MinUnboundedTrips
+  // iterations, days of running the loop.
+  TypeInfo VarType = TypeInfo::getDouble();
+  int64_t Start, Step;
+  ExprAST *Bound;
+  if (matchCountedLoop(Node, Start, Step, Bound)) {
+    auto *N = dyn_cast<NumberExprAST>(Bound);
+    if (N && std::isfinite(N->Val))
+      VarType = TypeInfo::getInt(
+          Start, std::max((double)Start, std::ceil(N->Val) - 1 + (double)Step));
+    else if ((MaxExact - Start) / Step >= MinUnboundedTrips)
+      VarType = TypeInfo::getInt(Start, MaxExact - 1);
+  }
+
+  BindingScope S(Scope);
+  bind(&Node, Node.VarName, VarType);
+  infer(Node.End);
+  if (Node.Step)
+    infer(Node.Step);
+  infer(Node.Body);
+  setResult(Node, TypeInfo::getDouble());
+  return nullptr;
+}
+
+Value *TypeInference::visit(VarExprAST &Node) {
+  BindingScope S(Scope);
+  for (unsigned i = 0, e = Node.VarNames.size(); i != e; ++i) {
+    auto &Var = Node.VarNames[i];
+    TypeInfo T = Var.second ? infer(Var.second) : TypeInfo::getInt(0, 0);
+
+    // Later initializers are in the variable's scope too.
+    bool Assigned = isAssigned(Node.Body, Var.first);
+    for (unsigned j = i + 1; j != e && !Assigned; ++j)
+      Assigned = isAssigned(Node.VarNames[j].second, Var.first);
+    bind(&Var, Var.first, Assigned ? TypeInfo::getDouble() : T);
+  }
+  setResult(Node, infer(Node.Body));
+  return nullptr;
+}
+
+Function *TypeInference::visit(FunctionAST &Node) {
+  run(Node.Body);
+  return nullptr;
+}
@@ -0,0 +1,117 @@
+//===- jit-lazy-bench.cpp - Lazy JIT prelude benchmark --------------------===//
+//
+// Loads a prelude of many definitions into the JIT and calls one of them,
+// once compiling every definition up front and once with -lazy, which only
+// compiles what is called, and reports the time of each.  The prelude is a
+// source file, or a synthetic one of -functions small loops.  The parser's
+// prompts go to stderr.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/raw_ostream.h"
+#include "../include/JIT.h"
+#include "../include/lexer.h"
+#include "../include/parser.h"
+#include "../include/tokens.h"
+
+#include <chrono>
+#include <memory>
+#include <string>
+
+using namespace llvm;
+
+static cl::opt<std::string>
+    InputFilename(cl::Positional,
+                  cl::desc("<prelude source file, synthesized if omitted>"),
+                  cl::init(""));
+
+static cl::opt<unsigned>
+    Functions("functions",
+              cl::desc("Number of definitions in the synthetic prelude"),
+              cl::init(2000));
+
+static cl::opt<unsigned> OptLevel("O", cl::desc("Optimization level"),
+                                  cl::init(2), cl::Prefix);
+
+/// synthesize - A prelude of Functions loops, followed by a call of one of
+/// them.
+static std::string synthesize() {
+  std::string Src;
+  for (unsigned N = 0; N < Functions; ++N)
+    Src += "def f" + std::to_string(N) +
+           "(x y) var s = 0 in (for i = 0, i < x in s = s + i*y + " +
+           std::to_string(N) + ") + s;\n";
+  Src += "f" + std::to_string(Functions / 2) + "(10, 2);\n";
+  return Src;
+}
+
+static CodeGenOpt::Level getCodeGenOptLevel() {
+  switch (OptLevel) {
+  case 0: return CodeGenOpt::None;
+  case 1: return CodeGenOpt::Less;
+  case 3: return CodeGenOpt::Aggressive;
+  default: return CodeGenOpt::Default;
+  }
+}
+
+int main(int argc, char *argv[]) {
+  InitLLVM X(argc, argv);
+  cl::ParseCommandLineOptions(argc, argv,
+                              "Kaleidoscope lazy JIT prelude benchmark\n");
+  InitializeNativeTarget();
+  InitializeNativeTargetAsmPrinter();
+  InitializeNativeTargetAsmParser();
+  ExitOnError ExitOnErr("jit-lazy-bench: ");
+
+  std::unique_ptr<MemoryBuffer> Buffer;
+  if (InputFilename.empty()) {
+    Buffer = MemoryBuffer::getMemBufferCopy(synthesize(), "<synthetic>");
+  } else {
+    auto FileOrErr = MemoryBuffer::getFile(InputFilename);
+    if (std::error_code EC = FileOrErr.getError()) {
+      errs() << "Error reading " << InputFilename << ": " << EC.message()
+             << "\n";
+      return 1;
+    }
+    Buffer = std::move(*FileOrErr);
+  }
+
+  SourceMgr SrcMgr;
+  SrcMgr.AddNewSourceBuffer(std::move(Buffer), SMLoc());
+  LexerFile Lex(SrcMgr);
+  TokenStream Tokens(Lex);
+  Tokens.lex();
+
+  outs() << "mode       seconds\n";
+  for (bool Lazy : {false, true}) {
+    auto JTMB = ExitOnErr(orc::JITTargetMachineBuilder::detectHost());
+    JTMB.setCodeGenOptLevel(getCodeGenOptLevel());
+    auto Context = std::make_unique<LLVMContext>();
+    auto M = std::make_unique<Module>("prelude", *Context);
+    OperatorTable Operators;
+    JITVisitor JIT(Operators, std::move(Context), std::move(M), OptLevel,
+                   std::move(JTMB));
+    JIT.setLazy(Lazy);
+    JIT.setPrintResults(false);
+
+    Parser P(Tokens, Operators, &JIT, /*isJit=*/true);
+    auto Start = std::chrono::steady_clock::now();
+    P.parse();
+    JIT.flush();
+    std::chrono::duration<double> Elapsed =
+        std::chrono::steady_clock::now() - Start;
+    outs() << format("%-5s %12.3f\n", Lazy ? "lazy" : "eager",
+                     Elapsed.count());
+  }
+  return 0;
+}
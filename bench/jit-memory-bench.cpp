@@ -0,0 +1,93 @@
+//===- jit-memory-bench.cpp - JIT memory manager benchmark ----------------===//
+//
+// Runs the allocate, finalize and release cycle the JIT goes through for the
+// object of every top level expression, once with a SectionMemoryManager per
+// object and once with a PooledMemoryManager per object over one shared
+// JITMemoryPool, and reports the time per object.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/ADT/Twine.h"
+#include "llvm/ExecutionEngine/SectionMemoryManager.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/raw_ostream.h"
+#include "../include/jitmemory.h"
+
+#include <chrono>
+#include <cstdint>
+
+using namespace llvm;
+
+static cl::opt<unsigned> Objects("objects",
+                                 cl::desc("Number of objects per pass"),
+                                 cl::init(100000));
+
+static cl::opt<unsigned> Repeat("repeat",
+                                cl::desc("Number of timed passes per manager"),
+                                cl::init(5));
+
+// Section sizes of the object of a typical top level expression.
+static const uintptr_t CodeSize = 200, RODataSize = 64, RWDataSize = 32;
+
+/// link - Lay out one object the way RuntimeDyld does, touch each section
+/// and finalize its protections.
+static void link(RTDyldMemoryManager &MM) {
+  if (MM.needsToReserveAllocationSpace())
+    MM.reserveAllocationSpace(CodeSize, 16, RODataSize, 16, RWDataSize, 8);
+  uint8_t *Code = MM.allocateCodeSection(CodeSize, 16, 0, ".text");
+  uint8_t *ROData = MM.allocateDataSection(RODataSize, 16, 1, ".rodata",
+                                           /*IsReadOnly=*/true);
+  uint8_t *RWData = MM.allocateDataSection(RWDataSize, 8, 2, ".data",
+                                           /*IsReadOnly=*/false);
+  Code[0] = 0xc3; // ret
+  ROData[0] = 1;
+  RWData[0] = 1;
+  std::string Err;
+  if (MM.finalizeMemory(&Err))
+    report_fatal_error(Twine("cannot finalize memory: ") + Err);
+}
+
+/// timePass - Seconds taken by Objects calls of Cycle.
+template <typename CycleT> static double timePass(CycleT Cycle) {
+  auto Start = std::chrono::steady_clock::now();
+  for (unsigned I = 0; I != Objects; ++I)
+    Cycle();
+  std::chrono::duration<double> Elapsed =
+      std::chrono::steady_clock::now() - Start;
+  return Elapsed.count();
+}
+
+/// best - The fastest of Repeat passes of Cycle, in microseconds per object.
+template <typename CycleT> static double best(CycleT Cycle) {
+  double Best = 0;
+  for (unsigned I = 0; I != Repeat; ++I) {
+    double Time = timePass(Cycle);
+    if (I == 0 || Time < Best)
+      Best = Time;
+  }
+  return Best * 1e6 / Objects;
+}
+
+int main(int argc, char *argv[]) {
+  InitLLVM X(argc, argv);
+  cl::ParseCommandLineOptions(argc, argv,
+                              "Kaleidoscope JIT memory manager benchmark\n");
+
+  double Section = best([] {
+    SectionMemoryManager MM;
+    link(MM);
+  });
+
+  JITMemoryPool Pool;
+  double Pooled = best([&] {
+    PooledMemoryManager MM(Pool);
+    link(MM);
+  });
+
+  outs() << format("SectionMemoryManager %9.2f us/object\n", Section)
+         << format("PooledMemoryManager  %9.2f us/object\n", Pooled);
+  Pool.printStats(outs());
+  return 0;
+}
@@ -0,0 +1,104 @@
+//===- jit-replay-bench.cpp - JIT query replay benchmark ------------------===//
+//
+// Replays a synthetic session of many small top level expressions, the way
+// a client feeding queries to the REPL does, through the JIT with each batch
+// size given by -batch, and reports the time per query.  A batch size of 1
+// gives every expression a module of its own.  The parser's prompts go to
+// stderr.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/raw_ostream.h"
+#include "../include/JIT.h"
+#include "../include/lexer.h"
+#include "../include/parser.h"
+#include "../include/tokens.h"
+
+#include <chrono>
+#include <initializer_list>
+#include <memory>
+#include <string>
+
+using namespace llvm;
+
+static cl::opt<unsigned> Queries("queries",
+                                 cl::desc("Number of top level expressions"),
+                                 cl::init(5000));
+
+static cl::list<unsigned>
+    BatchSizes("batch", cl::desc("Expressions per module (repeatable)"),
+               cl::ZeroOrMore);
+
+static cl::opt<unsigned> OptLevel("O", cl::desc("Optimization level"),
+                                  cl::init(0), cl::Prefix);
+
+/// synthesize - A definition followed by Queries expressions calling it.
+static std::string synthesize() {
+  std::string Src = "def f(x) x*2+1;\n";
+  for (unsigned N = 0; N < Queries; ++N)
+    Src += "f(" + std::to_string(N) + ")+" + std::to_string(N % 7) + ";\n";
+  return Src;
+}
+
+static CodeGenOpt::Level getCodeGenOptLevel() {
+  switch (OptLevel) {
+  case 0: return CodeGenOpt::None;
+  case 1: return CodeGenOpt::Less;
+  case 3: return CodeGenOpt::Aggressive;
+  default: return CodeGenOpt::Default;
+  }
+}
+
+int main(int argc, char *argv[]) {
+  InitLLVM X(argc, argv);
+  cl::ParseCommandLineOptions(argc, argv,
+                              "Kaleidoscope JIT query replay benchmark\n");
+  InitializeNativeTarget();
+  InitializeNativeTargetAsmPrinter();
+  InitializeNativeTargetAsmParser();
+  ExitOnError ExitOnErr("jit-replay-bench: ");
+
+  if (BatchSizes.empty())
+    for (unsigned Size : {1u, 100u, 1000u})
+      BatchSizes.push_back(Size);
+
+  SourceMgr SrcMgr;
+  SrcMgr.AddNewSourceBuffer(
+      MemoryBuffer::getMemBufferCopy(synthesize(), "<synthetic>"), SMLoc());
+  LexerFile Lex(SrcMgr);
+  TokenStream Tokens(Lex);
+  Tokens.lex();
+
+  outs() << "batch      seconds     us/query\n";
+  for (unsigned Size : BatchSizes) {
+    auto JTMB = ExitOnErr(orc::JITTargetMachineBuilder::detectHost());
+    JTMB.setCodeGenOptLevel(getCodeGenOptLevel());
+    auto Context = std::make_unique<LLVMContext>();
+    auto M = std::make_unique<Module>("replay", *Context);
+    OperatorTable Operators;
+    JITVisitor JIT(Operators, std::move(Context), std::move(M), OptLevel,
+                   std::move(JTMB));
+    JIT.setBatch(Size);
+    JIT.setPrintResults(false);
+
+    Parser P(Tokens, Operators, &JIT, /*isJit=*/true);
+    auto Start = std::chrono::steady_clock::now();
+    P.parse();
+    JIT.flush();
+    std::chrono::duration<double> Elapsed =
+        std::chrono::steady_clock::now() - Start;
+    outs() << format("%5u %12.3f %12.1f\n", Size, Elapsed.count(),
+                     Elapsed.count() * 1e6 / Queries);
+  }
+  return 0;
+}
@@ -0,0 +1,108 @@
+//===- lexer-bench.cpp - Lexer throughput benchmark -----------------------===//
+//
+// Lexes a source file (or a synthetic one shaped like our generated sources:
+// deep indentation and long comment banners) with every scanner the host
+// supports and reports the throughput in MB/s.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/raw_ostream.h"
+#include "../include/lexer.h"
+#include "../include/scan.h"
+
+#include <chrono>
+#include <initializer_list>
+#include <string>
+
+using namespace llvm;
+
+static cl::opt<std::string>
+    InputFilename(cl::Positional,
+                  cl::desc("<input source file, synthesized if omitted>"),
+                  cl::init(""));
+
+static cl::opt<unsigned>
+    SynthSize("size", cl::desc("Size of the synthetic source in MB"),
+              cl::init(16));
+
+static cl::opt<unsigned> Repeat("repeat",
+                                cl::desc("Number of timed passes per scanner"),
+                                cl::init(5));
+
+/// synthesize - Build a source of roughly Bytes bytes that looks like the
+/// output of our code generators.
+static std::string synthesize(size_t Bytes) {
+  std::string Src;
+  Src.reserve(Bytes + 512);
+  for (unsigned N = 0; Src.size() < Bytes; ++N) {
+    Src += "# ====================================================================\n";
+    Src += "#  generated function " + std::to_string(N) +
+           " -- do not edit by hand, regenerate with the table builder\n";
+    Src += "# ====================================================================\n";
+    Src += "def gen" + std::to_string(N) + "(x y)\n";
+    Src += "                var t = x * " + std::to_string(N % 97) + ".5 in\n";
+    Src += "                        if t < y then\n";
+    Src += "                                t + y\n";
+    Src += "                        else\n";
+    Src += "                                t - y;\n\n";
+  }
+  return Src;
+}
+
+/// lexAll - Run the lexer to the end of the buffer and return the token count.
+static unsigned lexAll(SourceMgr &SrcMgr, const scan::Scanner &S) {
+  LexerFile Lex(SrcMgr);
+  Lex.setScanner(S);
+  unsigned Tokens = 0;
+  while (Lex.gettok() != Token::tok_eof)
+    ++Tokens;
+  return Tokens;
+}
+
+int main(int argc, char *argv[]) {
+  InitLLVM X(argc, argv);
+  cl::ParseCommandLineOptions(argc, argv, "Kaleidoscope lexer benchmark\n");
+
+  std::unique_ptr<MemoryBuffer> Buffer;
+  if (InputFilename.empty()) {
+    Buffer = MemoryBuffer::getMemBufferCopy(
+        synthesize(size_t(SynthSize) << 20), "<synthetic>");
+  } else {
+    auto FileOrErr = MemoryBuffer::getFile(InputFilename);
+    if (std::error_code EC = FileOrErr.getError()) {
+      errs() << "Error reading " << InputFilename << ": " << EC.message()
+             << "\n";
+      return 1;
+    }
+    Buffer = std::move(*FileOrErr);
+  }
+
+  double MB = Buffer->getBufferSize() / double(1 << 20);
+  SourceMgr SrcMgr;
+  SrcMgr.AddNewSourceBuffer(std::move(Buffer), SMLoc());
+
+  outs() << format("input: %.2f MB\n", MB);
+  for (scan::Impl Kind : {scan::Impl::Scalar, scan::Impl::SSE2,
+                          scan::Impl::AVX2}) {
+    const scan::Scanner *S = scan::getScanner(Kind);
+    if (!S)
+      continue;
+
+    unsigned Tokens = lexAll(SrcMgr, *S); // warm up
+    double Best = 0;
+    for (unsigned I = 0; I != Repeat; ++I) {
+      auto Start = std::chrono::steady_clock::now();
+      lexAll(SrcMgr, *S);
+      std::chrono::duration<double> Elapsed =
+          std::chrono::steady_clock::now() - Start;
+      Best = std::max(Best, MB / Elapsed.count());
+    }
+    outs() << format("%-8s %10u tokens %10.1f MB/s\n", S->Name, Tokens, Best);
+  }
+  return 0;
+}
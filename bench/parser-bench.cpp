@@ -0,0 +1,124 @@
+//===- parser-bench.cpp - Expression parser stress benchmark --------------===//
+//
+// Parses synthetic definitions whose bodies are single operator chains of
+// growing length, mixing precedence levels the way generated code does, and
+// reports the parse time per operator.  Each definition is also simplified,
+// unless -simplify=false, so the chain is walked the way the compiler walks
+// it.  With a linear parser and simplifier the last column stays flat as the
+// chains grow.
+//
+//===----------------------------------------------------------------------===//
+
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/raw_ostream.h"
+#include "../include/lexer.h"
+#include "../include/parser.h"
+#include "../include/simplify.h"
+#include "../include/tokens.h"
+
+#include <chrono>
+#include <initializer_list>
+#include <string>
+
+using namespace llvm;
+
+static cl::list<unsigned>
+    Lengths("length", cl::desc("Operators per chain (repeatable)"),
+            cl::ZeroOrMore);
+
+static cl::opt<unsigned> Repeat("repeat",
+                                cl::desc("Number of timed passes per length"),
+                                cl::init(5));
+
+static cl::opt<bool> Simplify("simplify",
+                              cl::desc("Simplify each parsed definition"),
+                              cl::init(true));
+
+/// CountingVisitor - Accepts every definition without generating code.
+class CountingVisitor : public ASTVisitor {
+public:
+  unsigned Functions = 0;
+
+  Value *visit(NumberExprAST &) override { return nullptr; }
+  Value *visit(VariableExprAST &) override { return nullptr; }
+  Value *visit(UnaryExprAST &) override { return nullptr; }
+  Value *visit(BinaryExprAST &) override { return nullptr; }
+  Value *visit(CallExprAST &) override { return nullptr; }
+  Value *visit(IfExprAST &) override { return nullptr; }
+  Value *visit(ForExprAST &) override { return nullptr; }
+  Value *visit(VarExprAST &) override { return nullptr; }
+  Function *visit(PrototypeAST &) override { return nullptr; }
+  Function *visit(FunctionAST &) override {
+    ++Functions;
+    return nullptr;
+  }
+};
+
+/// synthesize - A definition whose body is a chain of Ops operators such as
+/// "x*2 + 1 : x*3 + 2 : ... : - - x".
+static std::string synthesize(unsigned Ops) {
+  std::string Src = "def chain(x)\n  x";
+  for (unsigned N = 0; N < Ops; ++N) {
+    switch (N % 4) {
+    case 0: Src += " * " + std::to_string(N % 7 + 2); break;
+    case 1: Src += " + " + std::to_string(N % 5); break;
+    case 2: Src += " < x"; break;
+    case 3: Src += " : - - x"; break;
+    }
+    if (N % 8 == 7)
+      Src += "\n ";
+  }
+  Src += ";\n";
+  return Src;
+}
+
+int main(int argc, char *argv[]) {
+  InitLLVM X(argc, argv);
+  cl::ParseCommandLineOptions(argc, argv, "Kaleidoscope parser benchmark\n");
+
+  if (Lengths.empty())
+    for (unsigned Len : {1000u, 10000u, 100000u, 1000000u})
+      Lengths.push_back(Len);
+
+  // ':' and unary '-' are user defined operators in our sources; only the
+  // precedence matters to the parser.
+  OperatorTable Operators;
+  Operators.addBinary(':', 1);
+
+  outs() << "operators      best ms  ns/operator\n";
+  for (unsigned Len : Lengths) {
+    SourceMgr SrcMgr;
+    SrcMgr.AddNewSourceBuffer(
+        MemoryBuffer::getMemBufferCopy(synthesize(Len), "<synthetic>"),
+        SMLoc());
+    LexerFile Lex(SrcMgr);
+    TokenStream Tokens(Lex);
+    Tokens.lex();
+
+    double Best = 0;
+    for (unsigned I = 0; I != Repeat; ++I) {
+      CountingVisitor V;
+      Parser P(Tokens, Operators, &V, false);
+      ASTSimplifier Simplifier(P.getContext(), Lex.getSymbols());
+      if (Simplify)
+        P.addPass(&Simplifier);
+      auto Start = std::chrono::steady_clock::now();
+      P.parse();
+      std::chrono::duration<double> Elapsed =
+          std::chrono::steady_clock::now() - Start;
+      if (V.Functions != 1) {
+        errs() << "chain of " << Len << " operators failed to parse\n";
+        return 1;
+      }
+      if (I == 0 || Elapsed.count() < Best)
+        Best = Elapsed.count();
+    }
+    outs() << format("%10u %12.3f %12.1f\n", Len, Best * 1e3,
+                     Best * 1e9 / Len);
+  }
+  return 0;
+}
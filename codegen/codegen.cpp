@@ -6,21 +6,19 @@
 #include "llvm/IR/Function.h"
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/Instructions.h"
+#include "llvm/IR/Intrinsics.h"
 #include "llvm/IR/LLVMContext.h"
-#include "llvm/IR/LegacyPassManager.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Type.h"
 #include "llvm/IR/Verifier.h"
-#include "llvm/Transforms/InstCombine/InstCombine.h"
-#include "llvm/Transforms/Scalar.h"
-#include "llvm/Transforms/Scalar/GVN.h"
-#include "llvm/Transforms/Utils.h"
 
+#include <cmath>
 #include <map>
 
 #include "../include/parser.h"
 #include "../include/codegen.h"
 #include "../include/AST.h"
+#include "../include/typeinference.h"
 
 using namespace llvm;
 
@@ -32,25 +30,14 @@ Value *CodeGenVisitor::LogErrorV(llvm::SMLoc Loc, const char *Str) {
   return nullptr;
 }
 
-void CodeGenVisitor::InitOptimPassManager() {
-    // Create a new pass manager attached to it.
-    TheFPM = std::make_unique<legacy::FunctionPassManager>(TheModule.get());
-    if (OptLevel > 0){
-        // Promote allocas to registers.
-        TheFPM->add(createPromoteMemoryToRegisterPass());
-        // Do simple "peephole" optimizations and bit-twiddling optzns.
-        TheFPM->add(createInstructionCombiningPass());
-        // Reassociate expressions.
-        TheFPM->add(createReassociatePass());
-        // Eliminate Common SubExpressions.
-        TheFPM->add(createGVNPass());
-        // Simplify the control flow graph (deleting unreachable blocks, etc).
-        TheFPM->add(createCFGSimplificationPass());
-    }
-    TheFPM->doInitialization();
+void CodeGenVisitor::LogRemark(llvm::SMLoc Loc, const Twine &Msg) {
+  if (SrcMgr && Loc.isValid())
+    SrcMgr->PrintMessage(Loc, llvm::SourceMgr::DiagKind::DK_Remark, Msg);
+  else
+    llvm::errs() << "remark: " << Msg << "\n";
 }
 
-Function * CodeGenVisitor::getFunction(std::string Name) {
+Function * CodeGenVisitor::getFunction(StringRef Name) {
   // First, see if the function has already been added to the current module.
   if (auto *F = TheModule->getFunction(Name))
     return F;
@@ -68,24 +55,87 @@ Function * CodeGenVisitor::getFunction(std::string Name) {
 /// CreateEntryBlockAlloca - Create an alloca instruction in the entry block of
 /// the function.  This is used for mutable variables etc.
 AllocaInst * CodeGenVisitor::CreateEntryBlockAlloca(Function *TheFunction,
-                                          StringRef VarName) {
+                                          StringRef VarName, Type *Ty) {
   IRBuilder<> TmpB(&TheFunction->getEntryBlock(),
                    TheFunction->getEntryBlock().begin());
-  return TmpB.CreateAlloca(Type::getDoubleTy(*TheContext), nullptr, VarName);
+  return TmpB.CreateAlloca(Ty ? Ty : Type::getDoubleTy(*TheContext), nullptr,
+                           VarName);
+}
+
+Type *CodeGenVisitor::getType(TypeInference::TypeKind Kind) {
+  switch (Kind) {
+  case TypeInference::TK_Bool:
+    return Type::getInt1Ty(*TheContext);
+  case TypeInference::TK_Int:
+    return Type::getInt64Ty(*TheContext);
+  case TypeInference::TK_Double:
+    return Type::getDoubleTy(*TheContext);
+  }
+  llvm_unreachable("unknown type kind");
+}
+
+/// convert - Convert V to To, preserving its value as a double.  A value
+/// converted to i1 is a truth value: true iff it is not zero (nor NaN).
+Value *CodeGenVisitor::convert(Value *V, Type *To) {
+  Type *From = V->getType();
+  if (From == To)
+    return V;
+  if (To->isIntegerTy(1))
+    return From->isDoubleTy()
+               ? Builder->CreateFCmpONE(
+                     V, ConstantFP::get(*TheContext, APFloat(0.0)), "tobool")
+               : Builder->CreateIsNotNull(V, "tobool");
+  if (To->isDoubleTy())
+    return From->isIntegerTy(1) ? Builder->CreateUIToFP(V, To, "booltmp")
+                                : Builder->CreateSIToFP(V, To, "inttmp");
+  // Integers are only ever widened; the analysis never narrows a double.
+  assert(From->isIntegerTy(1) && To->isIntegerTy(64) && "bad conversion");
+  return Builder->CreateZExt(V, To, "booltmp");
+}
+
+Value *CodeGenVisitor::lookupExpr(ExprAST *E) {
+  if (!ShareExprs)
+    return nullptr;
+  for (auto &Frame : llvm::reverse(ExprCache)) {
+    auto I = Frame.find(E);
+    if (I != Frame.end())
+      return I->second;
+  }
+  return nullptr;
+}
+
+void CodeGenVisitor::rememberExpr(ExprAST *E, Value *V) {
+  if (ShareExprs && !ExprCache.empty())
+    ExprCache.back()[E] = V;
+}
+
+void CodeGenVisitor::invalidateExprs() {
+  for (auto &Frame : ExprCache)
+    Frame.clear();
 }
 
 Value *CodeGenVisitor::visit(NumberExprAST &Node) {
+  if (Types.getType(&Node) == TypeInference::TK_Int)
+    return ConstantInt::get(Type::getInt64Ty(*TheContext), (int64_t)Node.Val,
+                            /*isSigned=*/true);
   return ConstantFP::get(*TheContext, APFloat(Node.Val));
 }
 
 Value * CodeGenVisitor::visit(VariableExprAST &Node) {
+  if (Value *V = lookupExpr(&Node))
+    return V;
+
   // Look this variable up in the function.
-  AllocaInst *A = NamedValues[Node.Name];
+  AllocaInst *A = NamedValues.lookup(Node.Name);
   if (!A)
     return LogErrorV(Node.getLocation(), "Unknown variable name");
 
-  // Load the value.
-  return Builder->CreateLoad(A->getAllocatedType(), A, Node.Name.c_str());
+  // Load the value.  A node shared between scopes may have a wider type
+  // than this binding.
+  Value *V = Builder->CreateLoad(A->getAllocatedType(), A, Node.Name.str());
+  V = convert(V, getType(Types.getType(&Node)));
+  rememberExpr(&Node, V);
+  return V;
 }
 
 Value * CodeGenVisitor::visit(UnaryExprAST &Node) {
@@ -93,69 +143,230 @@ Value * CodeGenVisitor::visit(UnaryExprAST &Node) {
   if (!OperandV)
     return nullptr;
 
+  // '!' is true when its operand is false, i.e. zero or NaN.
+  if (isBuiltinUnaryOp(Node.Opcode))
+    return Builder->CreateNot(convert(OperandV, Type::getInt1Ty(*TheContext)),
+                              "nottmp");
+
   Function *F = getFunction(std::string("unary") + Node.Opcode);
   if (!F)
     return LogErrorV(Node.getLocation(), "Unknown unary operator");
 
-  return Builder->CreateCall(F, OperandV, "unop");
+  return Builder->CreateCall(F, toDouble(OperandV), "unop");
 }
 
 Value * CodeGenVisitor::visit(BinaryExprAST &Node) {
   // Special case '=' because we don't want to emit the LHS as an expression.
   if (Node.Op == '=') {
     // Assignment requires the LHS to be an identifier.
-    // This assume we're building without RTTI because LLVM builds that way by
-    // default.  If you build LLVM with RTTI this can be changed to a
-    // dynamic_cast for automatic error checking.
-    VariableExprAST *LHSE = static_cast<VariableExprAST *>(Node.LHS.get());
+    VariableExprAST *LHSE = dyn_cast<VariableExprAST>(Node.LHS);
     if (!LHSE)
       return LogErrorV(Node.getLocation(), "destination of '=' must be a variable");
     // Codegen the RHS.
     Value *Val = Node.RHS->accept(*this);
     if (!Val)
       return nullptr;
+    // Assigned variables are always doubles.
+    Val = toDouble(Val);
 
     // Look up the name.
-    Value *Variable = NamedValues[LHSE->getName()];
+    Value *Variable = NamedValues.lookup(LHSE->getName());
     if (!Variable)
       return LogErrorV(LHSE->getLocation(), "Unknown variable name");
 
     Builder->CreateStore(Val, Variable);
+    invalidateExprs();
     return Val;
   }
 
-  Value *L = Node.LHS->accept(*this);
-  Value *R = Node.RHS->accept(*this);
-  if (!L || !R)
-    return nullptr;
+  if (Value *V = lookupExpr(&Node))
+    return V;
+
+  if (isLogicalOp(Node.Op)) {
+    Value *V = emitLogical(Node);
+    if (V)
+      rememberExpr(&Node, V);
+    return V;
+  }
+
+  // Emit a left-deep chain like a + b + c bottom up in a loop rather than
+  // recursing once per operator.  The chain ends at an operand this visitor
+  // has to handle specially.
+  SmallVector<BinaryExprAST *, 8> Spine = {&Node};
+  while (auto *B = dyn_cast<BinaryExprAST>(Spine.back()->LHS)) {
+    if (B->Op == '=' || isLogicalOp(B->Op) || lookupExpr(B))
+      break;
+    Spine.push_back(B);
+  }
+  Value *L = Spine.back()->LHS->accept(*this);
+  for (BinaryExprAST *B : reverse(Spine)) {
+    Value *R = B->RHS->accept(*this);
+    L = L && R ? emitBinaryOp(*B, L, R) : nullptr;
+  }
+  return L;
+}
 
+/// emitBinaryOp - Apply the non-logical operator of Node to its emitted
+/// operands L and R.
+Value *CodeGenVisitor::emitBinaryOp(BinaryExprAST &Node, Value *L, Value *R) {
+  // Builtin operators work on integers when the analysis proved both
+  // operands integral (and, for arithmetic, the result exact); otherwise on
+  // doubles.
+  Value *V = nullptr;
+  bool IsInt = Types.getType(&Node) == TypeInference::TK_Int;
+  if (isComparisonOp(Node.Op))
+    IsInt = Types.getType(Node.LHS) != TypeInference::TK_Double &&
+            Types.getType(Node.RHS) != TypeInference::TK_Double;
+  if (isPureBinaryOp(Node.Op)) {
+    Type *OpTy = IsInt ? Type::getInt64Ty(*TheContext)
+                       : Type::getDoubleTy(*TheContext);
+    L = convert(L, OpTy);
+    R = convert(R, OpTy);
+  }
   switch (Node.Op) {
   case '+':
-    return Builder->CreateFAdd(L, R, "addtmp");
+    V = IsInt ? Builder->CreateNSWAdd(L, R, "addtmp")
+              : Builder->CreateFAdd(L, R, "addtmp");
+    break;
   case '-':
-    return Builder->CreateFSub(L, R, "subtmp");
+    V = IsInt ? Builder->CreateNSWSub(L, R, "subtmp")
+              : Builder->CreateFSub(L, R, "subtmp");
+    break;
   case '*':
-    return Builder->CreateFMul(L, R, "multmp");
+    V = IsInt ? Builder->CreateNSWMul(L, R, "multmp")
+              : Builder->CreateFMul(L, R, "multmp");
+    break;
+  case '/':
+    V = Builder->CreateFDiv(L, R, "divtmp");
+    break;
+  // Comparisons stay i1; users that need a double convert them.
   case '<':
-    L = Builder->CreateFCmpULT(L, R, "cmptmp");
-    // Convert bool 0/1 to double 0.0 or 1.0
-    return Builder->CreateUIToFP(L, Type::getDoubleTy(*TheContext), "booltmp");
+    V = IsInt ? Builder->CreateICmpSLT(L, R, "cmptmp")
+              : Builder->CreateFCmpULT(L, R, "cmptmp");
+    break;
+  case '>':
+    V = IsInt ? Builder->CreateICmpSGT(L, R, "cmptmp")
+              : Builder->CreateFCmpUGT(L, R, "cmptmp");
+    break;
+  case BinOp::LE:
+    V = IsInt ? Builder->CreateICmpSLE(L, R, "cmptmp")
+              : Builder->CreateFCmpULE(L, R, "cmptmp");
+    break;
+  case BinOp::GE:
+    V = IsInt ? Builder->CreateICmpSGE(L, R, "cmptmp")
+              : Builder->CreateFCmpUGE(L, R, "cmptmp");
+    break;
+  case BinOp::EQ:
+    V = IsInt ? Builder->CreateICmpEQ(L, R, "cmptmp")
+              : Builder->CreateFCmpOEQ(L, R, "cmptmp");
+    break;
+  case BinOp::NE:
+    V = IsInt ? Builder->CreateICmpNE(L, R, "cmptmp")
+              : Builder->CreateFCmpUNE(L, R, "cmptmp");
+    break;
   default:
     break;
   }
+  if (V) {
+    rememberExpr(&Node, V);
+    return V;
+  }
 
   // If it wasn't a builtin binary operator, it must be a user defined one. Emit
   // a call to it.
   Function *F = getFunction(std::string("binary") + Node.Op);
   assert(F && "binary operator not found!");
 
-  Value *Ops[] = {L, R};
+  Value *Ops[] = {toDouble(L), toDouble(R)};
   return Builder->CreateCall(F, Ops, "binop");
 }
 
+/// emitLogical - Emit 'L && R' or 'L || R' as a branch around the
+/// evaluation of R, which only runs when L does not decide the result.
+Value *CodeGenVisitor::emitLogical(BinaryExprAST &Node) {
+  Type *BoolTy = Type::getInt1Ty(*TheContext);
+  bool IsAnd = Node.Op == BinOp::And;
+
+  Value *L = Node.LHS->accept(*this);
+  if (!L)
+    return nullptr;
+  L = convert(L, BoolTy);
+
+  Function *TheFunction = Builder->GetInsertBlock()->getParent();
+  BasicBlock *LHSBB = Builder->GetInsertBlock();
+  BasicBlock *RHSBB = BasicBlock::Create(
+      *TheContext, IsAnd ? "and.rhs" : "or.rhs", TheFunction);
+  BasicBlock *MergeBB = BasicBlock::Create(
+      *TheContext, IsAnd ? "and.end" : "or.end", TheFunction);
+  if (IsAnd)
+    Builder->CreateCondBr(L, RHSBB, MergeBB);
+  else
+    Builder->CreateCondBr(L, MergeBB, RHSBB);
+
+  // Like an if arm, the right operand does not dominate what follows.
+  Builder->SetInsertPoint(RHSBB);
+  pushExprScope();
+  Value *R = Node.RHS->accept(*this);
+  if (R)
+    R = convert(R, BoolTy);
+  popExprScope();
+  if (!R)
+    return nullptr;
+  Builder->CreateBr(MergeBB);
+  RHSBB = Builder->GetInsertBlock();
+
+  Builder->SetInsertPoint(MergeBB);
+  PHINode *PN = Builder->CreatePHI(BoolTy, 2, IsAnd ? "andtmp" : "ortmp");
+  PN->addIncoming(ConstantInt::get(BoolTy, !IsAnd), LHSBB);
+  PN->addIncoming(R, RHSBB);
+  return PN;
+}
+
+/// collectTailCalls - Record the calls of CurProto whose value is the value
+/// of E, i.e. the calls nothing is left to do after.
+void CodeGenVisitor::collectTailCalls(ExprAST *E) {
+  if (auto *C = dyn_cast<CallExprAST>(E)) {
+    if (C->Callee == CurProto->Name && C->Args.size() == CurProto->Args.size())
+      TailCalls.insert(C);
+  } else if (auto *I = dyn_cast<IfExprAST>(E)) {
+    collectTailCalls(I->Then);
+    collectTailCalls(I->Else);
+  } else if (auto *V = dyn_cast<VarExprAST>(E)) {
+    collectTailCalls(V->Body);
+  }
+}
+
+/// emitTailRecursion - Emit the self tail call Node as a jump back to the
+/// top of the function with the parameters rebound.
+Value *CodeGenVisitor::emitTailRecursion(CallExprAST &Node) {
+  // Every argument is computed from the old parameter values before any of
+  // them is overwritten.
+  SmallVector<Value *, 4> ArgsV;
+  for (ExprAST *Arg : Node.Args) {
+    ArgsV.push_back(Arg->accept(*this));
+    if (!ArgsV.back())
+      return nullptr;
+  }
+  for (unsigned i = 0, e = ArgsV.size(); i != e; ++i)
+    Builder->CreateStore(toDouble(ArgsV[i]), ParamAllocas[i]);
+  Builder->CreateBr(TailRecurseBB);
+  invalidateExprs();
+
+  if (Remarks)
+    LogRemark(Node.getLocation(), "converted tail call to '" +
+                                      Node.Callee.str() + "' into a loop");
+
+  // The caller still expects a value and somewhere to continue; both are
+  // unreachable and deleted by the first CFG cleanup.
+  Function *TheFunction = Builder->GetInsertBlock()->getParent();
+  Builder->SetInsertPoint(
+      BasicBlock::Create(*TheContext, "tailrecurse.dead", TheFunction));
+  return UndefValue::get(Type::getDoubleTy(*TheContext));
+}
+
 Value * CodeGenVisitor::visit(CallExprAST &Node) {
   // Look up the name in the global module table.
-  Function *CalleeF = getFunction(Node.Callee);
+  Function *CalleeF = getFunction(Node.Callee.str());
   if (!CalleeF)
     return LogErrorV(Node.getLocation(), "Unknown function referenced");
 
@@ -163,11 +374,15 @@ Value * CodeGenVisitor::visit(CallExprAST &Node) {
   if (CalleeF->arg_size() != Node.Args.size())
     return LogErrorV(Node.getLocation(), "Incorrect # arguments passed");
 
+  if (TailCalls.count(&Node))
+    return emitTailRecursion(Node);
+
   std::vector<Value *> ArgsV;
   for (unsigned i = 0, e = Node.Args.size(); i != e; ++i) {
     ArgsV.push_back(Node.Args[i]->accept(*this));
     if (!ArgsV.back())
       return nullptr;
+    ArgsV.back() = toDouble(ArgsV.back());
   }
 
   return Builder->CreateCall(CalleeF, ArgsV, "calltmp");
@@ -178,9 +393,9 @@ Value * CodeGenVisitor::visit(IfExprAST &Node) {
   if (!CondV)
     return nullptr;
 
-  // Convert condition to a bool by comparing non-equal to 0.0.
-  CondV = Builder->CreateFCmpONE(
-      CondV, ConstantFP::get(*TheContext, APFloat(0.0)), "ifcond");
+  // Convert condition to a bool by comparing non-equal to 0.0.  A
+  // comparison already is one.
+  CondV = convert(CondV, Type::getInt1Ty(*TheContext));
 
   Function *TheFunction = Builder->GetInsertBlock()->getParent();
 
@@ -192,10 +407,18 @@ Value * CodeGenVisitor::visit(IfExprAST &Node) {
 
   Builder->CreateCondBr(CondV, ThenBB, ElseBB);
 
-  // Emit then value.
+  // Emit then value.  Values computed in one arm do not dominate the other
+  // arm or the merge block, so each arm gets its own cache frame.
   Builder->SetInsertPoint(ThenBB);
 
+  // Both arms produce the type of the if.
+  Type *ResultTy = getType(Types.getType(&Node));
+
+  pushExprScope();
   Value *ThenV = Node.Then->accept(*this);
+  if (ThenV)
+    ThenV = convert(ThenV, ResultTy);
+  popExprScope();
   if (!ThenV)
     return nullptr;
 
@@ -206,7 +429,11 @@ Value * CodeGenVisitor::visit(IfExprAST &Node) {
   // Emit else block.
   Builder->SetInsertPoint(ElseBB);
 
+  pushExprScope();
   Value *ElseV = Node.Else->accept(*this);
+  if (ElseV)
+    ElseV = convert(ElseV, ResultTy);
+  popExprScope();
   if (!ElseV)
     return nullptr;
 
@@ -216,13 +443,85 @@ Value * CodeGenVisitor::visit(IfExprAST &Node) {
 
   // Emit merge block.
   Builder->SetInsertPoint(MergeBB);
-  PHINode *PN = Builder->CreatePHI(Type::getDoubleTy(*TheContext), 2, "iftmp");
+  PHINode *PN = Builder->CreatePHI(ResultTy, 2, "iftmp");
 
   PN->addIncoming(ThenV, ThenBB);
   PN->addIncoming(ElseV, ElseBB);
   return PN;
 }
 
+// A loop of the form
+//   for i = <integer>, i < <invariant>, <positive integer> in body
+// whose body never assigns to i is emitted with an i64 induction variable
+// and a trip test LLVM can compute the trip count of:
+//   bound = ceil(invariant), clamped to [-2^62, 2^62]
+//   br loop
+// loop:
+//   iv = phi [start, preheader], [nextvar, loop]
+//   store iv -> var              (converted if var is not an integer)
+//   bodyexpr
+//   nextvar = iv + step
+//   br iv < bound, loop, afterloop
+// For an integer i, i < x holds exactly when i < ceil(x); a NaN or huge
+// bound makes the loop run (practically) forever, as it does in doubles.
+Value *CodeGenVisitor::emitCountedLoop(ForExprAST &Node, AllocaInst *Alloca,
+                                       int64_t Start, int64_t Step,
+                                       ExprAST *Bound) {
+  Function *TheFunction = Builder->GetInsertBlock()->getParent();
+  Type *DoubleTy = Type::getDoubleTy(*TheContext);
+  Type *Int64Ty = Type::getInt64Ty(*TheContext);
+
+  // The bound does not depend on the loop, so compute it once up front.
+  Value *BoundV = Bound->accept(*this);
+  if (!BoundV)
+    return nullptr;
+  BoundV = toDouble(BoundV);
+  const double Limit = 0x1p62;
+  Value *Ceil = Builder->CreateUnaryIntrinsic(Intrinsic::ceil, BoundV);
+  Value *TooLow = Builder->CreateFCmpOLT(
+      BoundV, ConstantFP::get(DoubleTy, -Limit), "toolow");
+  Value *TooHigh = Builder->CreateFCmpUGE(
+      BoundV, ConstantFP::get(DoubleTy, Limit), "toohigh");
+  Ceil = Builder->CreateSelect(TooLow, ConstantFP::get(DoubleTy, -Limit), Ceil);
+  Ceil = Builder->CreateSelect(TooHigh, ConstantFP::get(DoubleTy, Limit), Ceil);
+  Value *BoundI = Builder->CreateFPToSI(Ceil, Int64Ty, "bound");
+
+  BasicBlock *PreheaderBB = Builder->GetInsertBlock();
+  BasicBlock *LoopBB = BasicBlock::Create(*TheContext, "loop", TheFunction);
+  Builder->CreateBr(LoopBB);
+  Builder->SetInsertPoint(LoopBB);
+
+  PHINode *IV = Builder->CreatePHI(Int64Ty, 2, Node.VarName.str() + ".iv");
+  IV->addIncoming(ConstantInt::get(Int64Ty, Start), PreheaderBB);
+  Builder->CreateStore(convert(IV, Alloca->getAllocatedType()), Alloca);
+
+  invalidateExprs();
+  pushExprScope();
+  VarScope Scope(NamedValues);
+  NamedValues.insert(Node.VarName, Alloca);
+
+  if (!Node.Body->accept(*this))
+    return nullptr;
+
+  // The step is a literal, so there is nothing to evaluate for it.  The
+  // end condition is tested on the value the body saw, as in the general
+  // case.
+  Value *NextVar = Builder->CreateAdd(IV, ConstantInt::get(Int64Ty, Step),
+                                      "nextvar", /*HasNUW=*/false,
+                                      /*HasNSW=*/true);
+  Value *EndCond = Builder->CreateICmpSLT(IV, BoundI, "loopcond");
+  IV->addIncoming(NextVar, Builder->GetInsertBlock());
+
+  BasicBlock *AfterBB =
+      BasicBlock::Create(*TheContext, "afterloop", TheFunction);
+  Builder->CreateCondBr(EndCond, LoopBB, AfterBB);
+  Builder->SetInsertPoint(AfterBB);
+  popExprScope();
+
+  // for expr always returns 0.0.
+  return Constant::getNullValue(DoubleTy);
+}
+
 // Output for-loop as:
 //   var = alloca double
 //   ...
@@ -246,12 +545,20 @@ Value * CodeGenVisitor::visit(ForExprAST &Node) {
   Function *TheFunction = Builder->GetInsertBlock()->getParent();
 
   // Create an alloca for the variable in the entry block.
-  AllocaInst *Alloca = CreateEntryBlockAlloca(TheFunction, Node.VarName);
+  AllocaInst *Alloca =
+      CreateEntryBlockAlloca(TheFunction, Node.VarName.str(),
+                             getType(Types.getBindingType(&Node)));
+
+  int64_t Start, Step;
+  ExprAST *Bound;
+  if (matchCountedLoop(Node, Start, Step, Bound))
+    return emitCountedLoop(Node, Alloca, Start, Step, Bound);
 
   // Emit the start code first, without 'variable' in scope.
   Value *StartVal = Node.Start->accept(*this);
   if (!StartVal)
     return nullptr;
+  StartVal = toDouble(StartVal);
 
   // Store the value into the alloca.
   Builder->CreateStore(StartVal, Alloca);
@@ -266,10 +573,15 @@ Value * CodeGenVisitor::visit(ForExprAST &Node) {
   // Start insertion in LoopBB.
   Builder->SetInsertPoint(LoopBB);
 
-  // Within the loop, the variable is defined equal to the PHI node.  If it
-  // shadows an existing variable, we have to restore it, so save it now.
-  AllocaInst *OldVal = NamedValues[Node.VarName];
-  NamedValues[Node.VarName] = Alloca;
+  // A value computed before the loop is stale from the second iteration on
+  // if the body stores to one of its variables, so start from scratch.
+  invalidateExprs();
+  pushExprScope();
+
+  // Within the loop, the variable is defined equal to the PHI node.  It
+  // shadows any outer variable of the same name until Scope is closed.
+  VarScope Scope(NamedValues);
+  NamedValues.insert(Node.VarName, Alloca);
 
   // Emit the body of the loop.  This, like any other expr, can change the
   // current BB.  Note that we ignore the value computed by the body, but don't
@@ -283,6 +595,7 @@ Value * CodeGenVisitor::visit(ForExprAST &Node) {
     StepVal = Node.Step->accept(*this);
     if (!StepVal)
       return nullptr;
+    StepVal = toDouble(StepVal);
   } else {
     // If not specified, use 1.0.
     StepVal = ConstantFP::get(*TheContext, APFloat(1.0));
@@ -296,13 +609,12 @@ Value * CodeGenVisitor::visit(ForExprAST &Node) {
   // Reload, increment, and restore the alloca.  This handles the case where
   // the body of the loop mutates the variable.
   Value *CurVar =
-      Builder->CreateLoad(Alloca->getAllocatedType(), Alloca, Node.VarName.c_str());
+      Builder->CreateLoad(Alloca->getAllocatedType(), Alloca, Node.VarName.str());
   Value *NextVar = Builder->CreateFAdd(CurVar, StepVal, "nextvar");
   Builder->CreateStore(NextVar, Alloca);
 
   // Convert condition to a bool by comparing non-equal to 0.0.
-  EndCond = Builder->CreateFCmpONE(
-      EndCond, ConstantFP::get(*TheContext, APFloat(0.0)), "loopcond");
+  EndCond = convert(EndCond, Type::getInt1Ty(*TheContext));
 
   // Create the "after loop" block and insert it.
   BasicBlock *AfterBB =
@@ -313,26 +625,24 @@ Value * CodeGenVisitor::visit(ForExprAST &Node) {
 
   // Any new code will be inserted in AfterBB.
   Builder->SetInsertPoint(AfterBB);
-
-  // Restore the unshadowed variable.
-  if (OldVal)
-    NamedValues[Node.VarName] = OldVal;
-  else
-    NamedValues.erase(Node.VarName);
+  popExprScope();
 
   // for expr always returns 0.0.
   return Constant::getNullValue(Type::getDoubleTy(*TheContext));
 }
 
 Value * CodeGenVisitor::visit(VarExprAST &Node) {
-  std::vector<AllocaInst *> OldBindings;
-
   Function *TheFunction = Builder->GetInsertBlock()->getParent();
 
+  // Reads of the new variables must not outlive the scope.
+  pushExprScope();
+  VarScope Scope(NamedValues);
+
   // Register all variables and emit their initializer.
   for (unsigned i = 0, e = Node.VarNames.size(); i != e; ++i) {
-    const std::string &VarName = Node.VarNames[i].first;
-    ExprAST *Init = Node.VarNames[i].second.get();
+    Symbol VarName = Node.VarNames[i].first;
+    ExprAST *Init = Node.VarNames[i].second;
+    Type *VarTy = getType(Types.getBindingType(&Node.VarNames[i]));
 
     // Emit the initializer before adding the variable to scope, this prevents
     // the initializer from referencing the variable itself, and permits stuff
@@ -344,19 +654,21 @@ Value * CodeGenVisitor::visit(VarExprAST &Node) {
       InitVal = Init->accept(*this);
       if (!InitVal)
         return nullptr;
+      InitVal = convert(InitVal, VarTy);
     } else { // If not specified, use 0.0.
-      InitVal = ConstantFP::get(*TheContext, APFloat(0.0));
+      InitVal = Constant::getNullValue(VarTy);
     }
 
-    AllocaInst *Alloca = CreateEntryBlockAlloca(TheFunction, VarName);
+    AllocaInst *Alloca =
+        CreateEntryBlockAlloca(TheFunction, VarName.str(), VarTy);
     Builder->CreateStore(InitVal, Alloca);
 
-    // Remember the old variable binding so that we can restore the binding when
-    // we unrecurse.
-    OldBindings.push_back(NamedValues[VarName]);
+    // Shadowing changes what the (possibly shared) variable node reads.
+    if (NamedValues.lookup(VarName))
+      invalidateExprs();
 
-    // Remember this binding.
-    NamedValues[VarName] = Alloca;
+    // Remember this binding.  Closing Scope drops it again.
+    NamedValues.insert(VarName, Alloca);
   }
 
   // Codegen the body, now that all vars are in scope.
@@ -364,9 +676,7 @@ Value * CodeGenVisitor::visit(VarExprAST &Node) {
   if (!BodyVal)
     return nullptr;
 
-  // Pop all our variables from scope.
-  for (unsigned i = 0, e = Node.VarNames.size(); i != e; ++i)
-    NamedValues[Node.VarNames[i].first] = OldBindings[i];
+  popExprScope();
 
   // Return the body computation.
   return BodyVal;
@@ -379,35 +689,63 @@ Function * CodeGenVisitor::visit(PrototypeAST &Node) {
       FunctionType::get(Type::getDoubleTy(*TheContext), Doubles, false);
 
   Function *F =
-      Function::Create(FT, Function::ExternalLinkage, Node.Name, TheModule.get());
+      Function::Create(FT, Function::ExternalLinkage, Node.Name.str(), TheModule.get());
 
   // Set names for all arguments.
   unsigned Idx = 0;
   for (auto &Arg : F->args())
-    Arg.setName(Node.Args[Idx++]);
+    Arg.setName(Node.Args[Idx++].str());
+
+  // An extern is only ever seen here.  Keep its prototype so that later
+  // modules of the JIT can declare it too.
+  if (!FunctionProtos.count(Node.Name.str()))
+    FunctionProtos[Node.Name.str()] = std::make_unique<PrototypeAST>(Node);
 
+  addEffectAttrs(*F);
   return F;
 }
 
+/// addEffectAttrs - Tell LLVM what Purity knows about F, so that calls to a
+/// pure function can be merged, hoisted out of loops or, if it will
+/// return, dropped when unused.
+void CodeGenVisitor::addEffectAttrs(Function &F) {
+  PurityAnalysis::Effects Effects = Purity.getEffects(F.getName());
+  if (!Effects.Pure)
+    return;
+  F.setDoesNotAccessMemory();
+  F.setDoesNotThrow();
+  if (Effects.WillReturn)
+    F.addFnAttr(Attribute::WillReturn);
+}
+
 Function * CodeGenVisitor::visit(FunctionAST &Node) {
   // Transfer ownership of the prototype to the FunctionProtos map, but keep a
   // reference to it for use below.
   auto &P = *(Node.Proto);
-  FunctionProtos[Node.Proto->getName()] = std::move(Node.Proto);
-  Function *TheFunction = getFunction(P.getName());
+  FunctionProtos[Node.Proto->getName().str()] = std::move(Node.Proto);
+  Function *TheFunction = getFunction(P.getName().str());
   if (!TheFunction)
     return nullptr;
+  FP.apply(*TheFunction);
+  Purity.analyze(P, Node.Body);
+  addEffectAttrs(*TheFunction);
 
   // If this is an operator, install it.
   if (P.isBinaryOp())
-    Parser::BinopPrecedence[P.getOperatorName()] = P.getBinaryPrecedence();
+    Operators.addBinary(P.getOperatorName(), P.getBinaryPrecedence());
+  else if (P.isUnaryOp())
+    Operators.addUnary(P.getOperatorName());
 
   // Create a new basic block to start insertion into.
   BasicBlock *BB = BasicBlock::Create(*TheContext, "entry", TheFunction);
   Builder->SetInsertPoint(BB);
 
   // Record the function arguments in the NamedValues map.
-  NamedValues.clear();
+  VarScope Scope(NamedValues);
+  ExprCache.clear();
+  pushExprScope();
+  ParamAllocas.clear();
+  unsigned Idx = 0;
   for (auto &Arg : TheFunction->args()) {
     // Create an alloca for this variable.
     AllocaInst *Alloca = CreateEntryBlockAlloca(TheFunction, Arg.getName());
@@ -416,27 +754,40 @@ Function * CodeGenVisitor::visit(FunctionAST &Node) {
     Builder->CreateStore(&Arg, Alloca);
 
     // Add arguments to variable symbol table.
-    NamedValues[std::string(Arg.getName())] = Alloca;
+    NamedValues.insert(P.Args[Idx++], Alloca);
+    ParamAllocas.push_back(Alloca);
+  }
+
+  Types.run(Node.Body);
+
+  CurProto = &P;
+  TailCalls.clear();
+  TailRecurseBB = nullptr;
+  collectTailCalls(Node.Body);
+  if (!TailCalls.empty()) {
+    TailRecurseBB = BasicBlock::Create(*TheContext, "tailrecurse", TheFunction);
+    Builder->CreateBr(TailRecurseBB);
+    Builder->SetInsertPoint(TailRecurseBB);
   }
 
   if (Value *RetVal = Node.Body->accept(*this)) {
     // Finish off the function.
-    Builder->CreateRet(RetVal);
+    Builder->CreateRet(toDouble(RetVal));
 
     // Validate the generated code, checking for consistency.
     verifyFunction(*TheFunction);
 
-    // Run the optimizer on the function.
-    TheFPM->run(*TheFunction);
-
     return TheFunction;
   }
 
   // Error reading body, remove function.
   TheFunction->eraseFromParent();
+  Purity.forget(P.getName().str());
 
   if (P.isBinaryOp())
-    Parser::BinopPrecedence.erase(P.getOperatorName());
+    Operators.removeBinary(P.getOperatorName());
+  else if (P.isUnaryOp())
+    Operators.removeUnary(P.getOperatorName());
   return nullptr;
 }
 
@@ -0,0 +1,176 @@
+#include "../include/multiversion.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Triple.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/GlobalIFunc.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/Instructions.h"
+#include "llvm/Transforms/Utils/Cloning.h"
+#include "llvm/Transforms/Utils/ValueMapper.h"
+
+#include <algorithm>
+
+using namespace llvm;
+
+// Bits of __cpu_model.__cpu_features[0], in the order of the
+// ProcessorFeatures enum libgcc and compiler-rt share.
+enum : uint32_t {
+  FeaturePOPCNT = 1u << 2,
+  FeatureSSE3 = 1u << 5,
+  FeatureSSSE3 = 1u << 6,
+  FeatureSSE4_1 = 1u << 7,
+  FeatureSSE4_2 = 1u << 8,
+  FeatureAVX = 1u << 9,
+  FeatureAVX2 = 1u << 10,
+  FeatureFMA = 1u << 14,
+  FeatureAVX512F = 1u << 15,
+  FeatureBMI = 1u << 16,
+  FeatureBMI2 = 1u << 17,
+  FeatureAVX512VL = 1u << 20,
+  FeatureAVX512BW = 1u << 21,
+  FeatureAVX512DQ = 1u << 22,
+  FeatureAVX512CD = 1u << 23,
+};
+
+/// getRequiredFeatures - The features a CPU must report to run code built
+/// for Level, as far as __cpu_features[0] records them.  The few features
+/// of a level it does not record (CMPXCHG16B, F16C, LZCNT, MOVBE, ...) come
+/// with every CPU that has the ones it does.
+static Optional<uint32_t> getRequiredFeatures(StringRef Level) {
+  const uint32_t V2 =
+      FeaturePOPCNT | FeatureSSE3 | FeatureSSSE3 | FeatureSSE4_1 |
+      FeatureSSE4_2;
+  const uint32_t V3 =
+      V2 | FeatureAVX | FeatureAVX2 | FeatureFMA | FeatureBMI | FeatureBMI2;
+  const uint32_t V4 = V3 | FeatureAVX512F | FeatureAVX512VL |
+                      FeatureAVX512BW | FeatureAVX512DQ | FeatureAVX512CD;
+  if (Level == "x86-64")
+    return 0u;
+  if (Level == "x86-64-v2")
+    return V2;
+  if (Level == "x86-64-v3")
+    return V3;
+  if (Level == "x86-64-v4")
+    return V4;
+  return None;
+}
+
+/// emitResolver - Define the ifunc resolver for a function whose versions
+/// are Versions, one per level with the features in Required.  The levels
+/// are sorted, the baseline first.
+static Function *emitResolver(Module &M, Function &F,
+                              ArrayRef<Function *> Versions,
+                              ArrayRef<uint32_t> Required) {
+  LLVMContext &Ctx = M.getContext();
+  Type *Int32Ty = Type::getInt32Ty(Ctx);
+
+  // struct __processor_model { unsigned vendor, type, subtype;
+  //                            unsigned features[1]; } __cpu_model;
+  StructType *CPUModelTy = StructType::get(
+      Int32Ty, Int32Ty, Int32Ty, ArrayType::get(Int32Ty, 1));
+  Constant *CPUModel = M.getOrInsertGlobal("__cpu_model", CPUModelTy);
+  // Resolvers run before constructors, including the one that fills in
+  // __cpu_model, so they initialize it themselves.
+  FunctionCallee Init = M.getOrInsertFunction(
+      "__cpu_indicator_init", FunctionType::get(Type::getVoidTy(Ctx), false));
+
+  Function *Resolver =
+      Function::Create(FunctionType::get(F.getType(), false),
+                       GlobalValue::InternalLinkage, F.getName() + ".resolver",
+                       &M);
+  IRBuilder<> Builder(BasicBlock::Create(Ctx, "entry", Resolver));
+  Builder.CreateCall(Init);
+  Constant *Indices[] = {Builder.getInt32(0), Builder.getInt32(3),
+                         Builder.getInt32(0)};
+  Value *Features = Builder.CreateLoad(
+      Int32Ty,
+      ConstantExpr::getInBoundsGetElementPtr(CPUModelTy, CPUModel, Indices),
+      "features");
+
+  // Higher levels win over lower ones.
+  Value *Result = Versions[0];
+  for (unsigned I = 1, E = Versions.size(); I != E; ++I) {
+    Value *Has = Builder.CreateICmpEQ(
+        Builder.CreateAnd(Features, Required[I]), Builder.getInt32(Required[I]),
+        "has." + Versions[I]->getName());
+    Result = Builder.CreateSelect(Has, Versions[I], Result);
+  }
+  Builder.CreateRet(Result);
+  return Resolver;
+}
+
+Error multiversion(Module &M, ArrayRef<std::string> Levels) {
+  if (Levels.empty())
+    return Error::success();
+
+  Triple T(M.getTargetTriple());
+  if ((T.getArch() != Triple::x86 && T.getArch() != Triple::x86_64) ||
+      !T.isOSBinFormatELF())
+    return createStringError(inconvertibleErrorCode(),
+                             "multiversioning needs an x86 ELF target, not '" +
+                                 M.getTargetTriple() + "'");
+
+  // Sort the levels by their features, each of which includes the features
+  // of the levels below it, and make sure the baseline is there for CPUs
+  // that have none of the others.
+  SmallVector<std::pair<uint32_t, StringRef>, 4> Sorted = {{0u, "x86-64"}};
+  for (const std::string &Level : Levels) {
+    Optional<uint32_t> Features = getRequiredFeatures(Level);
+    if (!Features)
+      return createStringError(inconvertibleErrorCode(),
+                               "unknown micro-architecture level '" + Level +
+                                   "'");
+    Sorted.push_back({*Features, Level});
+  }
+  llvm::sort(Sorted);
+  Sorted.erase(std::unique(Sorted.begin(), Sorted.end()), Sorted.end());
+
+  SmallVector<uint32_t, 4> Required;
+  SmallVector<StringRef, 4> SortedLevels;
+  for (auto &Level : Sorted) {
+    Required.push_back(Level.first);
+    SortedLevels.push_back(Level.second);
+  }
+
+  SmallVector<Function *, 8> Exported;
+  for (Function &F : M)
+    if (!F.isDeclaration() && F.hasExternalLinkage() && F.getName() != "main")
+      Exported.push_back(&F);
+
+  // Versions[F][I] - The version of F for Levels[I].
+  DenseMap<Function *, SmallVector<Function *, 4>> Versions;
+  for (Function *F : Exported) {
+    for (StringRef Level : SortedLevels) {
+      ValueToValueMapTy VMap;
+      Function *Clone = CloneFunction(F, VMap);
+      Clone->setName(F->getName() + "." + Level);
+      Clone->setLinkage(GlobalValue::InternalLinkage);
+      Clone->addFnAttr("target-cpu", Level);
+      Versions[F].push_back(Clone);
+    }
+  }
+
+  // Within one level, exported functions call each other directly.
+  for (Function *F : Exported)
+    for (unsigned I = 0, E = SortedLevels.size(); I != E; ++I)
+      for (Instruction &Inst : instructions(Versions[F][I]))
+        if (auto *Call = dyn_cast<CallInst>(&Inst))
+          if (Function *Callee = Call->getCalledFunction())
+            if (Versions.count(Callee))
+              Call->setCalledFunction(Versions[Callee][I]);
+
+  // Everyone else calls through the ifunc, which takes over the name.
+  for (Function *F : Exported) {
+    Function *Resolver = emitResolver(M, *F, Versions[F], Required);
+    GlobalIFunc *IFunc = GlobalIFunc::create(
+        F->getFunctionType(), F->getAddressSpace(), F->getLinkage(), "",
+        Resolver, &M);
+    IFunc->takeName(F);
+    F->replaceAllUsesWith(IFunc);
+    F->eraseFromParent();
+  }
+  return Error::success();
+}
@@ -0,0 +1,41 @@
+#include "../include/optimizer.h"
+
+using namespace llvm;
+
+static PassBuilder::OptimizationLevel getLevel(int OptLevel) {
+  switch (OptLevel) {
+  case 1:
+    return PassBuilder::OptimizationLevel::O1;
+  case 2:
+    return PassBuilder::OptimizationLevel::O2;
+  case -1:
+    return PassBuilder::OptimizationLevel::Os;
+  case -2:
+    return PassBuilder::OptimizationLevel::Oz;
+  default:
+    return PassBuilder::OptimizationLevel::O3;
+  }
+}
+
+Optimizer::Optimizer(int OptLevel, TargetMachine *TM)
+    : OptLevel(OptLevel), PB(/*DebugLogging=*/false, TM) {
+  PB.registerModuleAnalyses(MAM);
+  PB.registerCGSCCAnalyses(CGAM);
+  PB.registerFunctionAnalyses(FAM);
+  PB.registerLoopAnalyses(LAM);
+  PB.crossRegisterProxies(LAM, FAM, CGAM, MAM);
+
+  if (OptLevel != 0)
+    MPM = PB.buildPerModuleDefaultPipeline(getLevel(OptLevel));
+}
+
+void Optimizer::run(Module &M) {
+  if (OptLevel == 0)
+    return;
+  MPM.run(M, MAM);
+  // Cached results refer to IR that the JIT is about to take over.
+  LAM.clear();
+  FAM.clear();
+  CGAM.clear();
+  MAM.clear();
+}
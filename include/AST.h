@@ -3,10 +3,17 @@
 
 #include <string>
 #include <memory>
+#include <utility>
 #include <vector>
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
 #include "llvm/IR/Value.h"
 #include "llvm/IR/Function.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/MathExtras.h"
 #include "llvm/Support/SMLoc.h"
+#include "lexer.h"
+#include "symbol.h"
 
 using namespace llvm;
 
@@ -35,17 +42,93 @@ public:
     virtual Value* visit(VarExprAST&) = 0;
     virtual Function* visit(PrototypeAST&) = 0;
     virtual Function* visit(FunctionAST&) = 0; 
+    /// definitionRejected - Tells a pass that the visitor rejected the
+    /// definition the pass saw last, so that it can forget about it.
+    virtual void definitionRejected() {}
     virtual ~ASTVisitor() {}
 };
 
+/// ASTContext - Bump allocator that owns the expression nodes of one
+/// top-level definition.  Nodes are never destroyed one by one; the whole
+/// tree is released at once by reset(), so they must not own any memory
+/// outside of the arena.
+///
+/// With uniquing enabled the get* factories hash-cons pure expressions
+/// (literals, variable reads and builtin arithmetic over pure operands), so
+/// structurally identical subtrees become one shared node and the tree
+/// turns into a DAG.  A shared node keeps the location of its first
+/// occurrence.
+class ASTContext {
+  llvm::BumpPtrAllocator Alloc;
+  bool Uniquing = false;
+
+  // Literals are keyed by their bit pattern so that 0.0 and -0.0 stay
+  // distinct.  The two keys DenseMap reserves are NaNs, which the lexer
+  // never produces.
+  llvm::DenseMap<uint64_t, NumberExprAST *> Numbers;
+  llvm::DenseMap<Symbol, VariableExprAST *> Variables;
+  using BinaryKey = std::pair<std::pair<ExprAST *, ExprAST *>, char>;
+  llvm::DenseMap<BinaryKey, BinaryExprAST *> Binaries;
+
+public:
+  template <typename T, typename... ArgTs> T *create(ArgTs &&... Args) {
+    return new (Alloc.Allocate<T>()) T(std::forward<ArgTs>(Args)...);
+  }
+
+  void setUniquing(bool Enable) { Uniquing = Enable; }
+  bool isUniquing() const { return Uniquing; }
+
+  NumberExprAST *getNumber(double Val, llvm::SMLoc Loc);
+  VariableExprAST *getVariable(Symbol Name, llvm::SMLoc Loc);
+  BinaryExprAST *getBinary(char Op, ExprAST *LHS, ExprAST *RHS,
+                           llvm::SMLoc Loc);
+
+  /// isPure - True if E was produced by the uniquing factories, which
+  /// implies it has no side effects and can be evaluated once per scope.
+  bool isPure(ExprAST *E) const;
+
+  /// copyArray - Copy Elts into the arena.
+  template <typename T> llvm::ArrayRef<T> copyArray(llvm::ArrayRef<T> Elts) {
+    if (Elts.empty())
+      return llvm::ArrayRef<T>();
+    T *Mem = Alloc.Allocate<T>(Elts.size());
+    std::uninitialized_copy(Elts.begin(), Elts.end(), Mem);
+    return llvm::ArrayRef<T>(Mem, Elts.size());
+  }
+
+  /// reset - Free every node allocated since the last reset.
+  void reset() {
+    Numbers.clear();
+    Variables.clear();
+    Binaries.clear();
+    Alloc.Reset();
+  }
+};
+
 class ExprAST {
+public:
+  /// ExprKind - Discriminator for LLVM-style isa<>/dyn_cast<>.
+  enum ExprKind {
+    EK_Number,
+    EK_Variable,
+    EK_Unary,
+    EK_Binary,
+    EK_Call,
+    EK_If,
+    EK_For,
+    EK_Var
+  };
+
+private:
+  const ExprKind Kind;
   llvm::SMLoc Loc;
+
 public:
-  ExprAST(llvm::SMLoc Loc) : Loc(Loc) {}
+  ExprAST(ExprKind Kind, llvm::SMLoc Loc) : Kind(Kind), Loc(Loc) {}
 
-  virtual ~ExprAST() = default;
   virtual Value* accept(ASTVisitor &V) = 0;
 
+  ExprKind getKind() const { return Kind; }
   llvm::SMLoc getLocation() { return Loc; }
 };
 
@@ -54,130 +137,132 @@ class NumberExprAST : public ExprAST {
 public:
   double Val;
 
-  NumberExprAST(double Val, llvm::SMLoc Loc) : ExprAST(Loc),Val(Val) {}
+  NumberExprAST(double Val, llvm::SMLoc Loc) : ExprAST(EK_Number, Loc),Val(Val) {}
   
   Value* accept(ASTVisitor &V) override { return V.visit(*this); }
+  static bool classof(const ExprAST *E) { return E->getKind() == EK_Number; }
 };
 
 /// VariableExprAST - Expression class for referencing a variable, like "a".
 class VariableExprAST : public ExprAST {
 public:
-  std::string Name;
-  VariableExprAST(const std::string &Name, llvm::SMLoc Loc) 
-          : ExprAST(Loc), Name(Name) {}
+  Symbol Name;
+  VariableExprAST(Symbol Name, llvm::SMLoc Loc) 
+          : ExprAST(EK_Variable, Loc), Name(Name) {}
 
   Value* accept(ASTVisitor &V) override { return V.visit(*this); }
-  const std::string &getName() const { return Name; }
+  static bool classof(const ExprAST *E) { return E->getKind() == EK_Variable; }
+  Symbol getName() const { return Name; }
 };
 
 /// UnaryExprAST - Expression class for a unary operator.
 class UnaryExprAST : public ExprAST {
 public:
   char Opcode;
-  std::unique_ptr<ExprAST> Operand;
+  ExprAST *Operand;
 
-  UnaryExprAST(char Opcode, std::unique_ptr<ExprAST> Operand, llvm::SMLoc Loc)
-      : ExprAST(Loc), Opcode(Opcode), Operand(std::move(Operand)) {}
+  UnaryExprAST(char Opcode, ExprAST *Operand, llvm::SMLoc Loc)
+      : ExprAST(EK_Unary, Loc), Opcode(Opcode), Operand(Operand) {}
 
   Value* accept(ASTVisitor &V) override { return V.visit(*this); }
+  static bool classof(const ExprAST *E) { return E->getKind() == EK_Unary; }
 };
 
 /// BinaryExprAST - Expression class for a binary operator.
 class BinaryExprAST : public ExprAST {
 public:
   char Op;
-  std::unique_ptr<ExprAST> LHS, RHS;
+  ExprAST *LHS, *RHS;
 
-  BinaryExprAST(char Op, std::unique_ptr<ExprAST> LHS,
-                std::unique_ptr<ExprAST> RHS, llvm::SMLoc Loc)
-      : ExprAST(Loc), Op(Op), LHS(std::move(LHS)), RHS(std::move(RHS)) {}
+  BinaryExprAST(char Op, ExprAST *LHS, ExprAST *RHS, llvm::SMLoc Loc)
+      : ExprAST(EK_Binary, Loc), Op(Op), LHS(LHS), RHS(RHS) {}
 
   Value* accept(ASTVisitor &V) override { return V.visit(*this); }
+  static bool classof(const ExprAST *E) { return E->getKind() == EK_Binary; }
 };
 
 /// CallExprAST - Expression class for function calls.
 class CallExprAST : public ExprAST {
 public:
-  std::string Callee;
-  std::vector<std::unique_ptr<ExprAST>> Args;
+  Symbol Callee;
+  llvm::ArrayRef<ExprAST *> Args; // Allocated in the ASTContext.
 
-  CallExprAST(const std::string &Callee,
-              std::vector<std::unique_ptr<ExprAST>> Args,
-              llvm::SMLoc Loc)
-      : ExprAST(Loc), Callee(Callee), Args(std::move(Args)) {}
+  CallExprAST(Symbol Callee, llvm::ArrayRef<ExprAST *> Args, llvm::SMLoc Loc)
+      : ExprAST(EK_Call, Loc), Callee(Callee), Args(Args) {}
 
   Value* accept(ASTVisitor &V) override { return V.visit(*this); }
+  static bool classof(const ExprAST *E) { return E->getKind() == EK_Call; }
 };
 
 /// IfExprAST - Expression class for if/then/else.
 class IfExprAST : public ExprAST {
 public:
-  std::unique_ptr<ExprAST> Cond, Then, Else;
+  ExprAST *Cond, *Then, *Else;
 
-  IfExprAST(std::unique_ptr<ExprAST> Cond, std::unique_ptr<ExprAST> Then,
-            std::unique_ptr<ExprAST> Else, llvm::SMLoc Loc)
-      : ExprAST(Loc), Cond(std::move(Cond)), Then(std::move(Then)), 
-        Else(std::move(Else)) {}
+  IfExprAST(ExprAST *Cond, ExprAST *Then, ExprAST *Else, llvm::SMLoc Loc)
+      : ExprAST(EK_If, Loc), Cond(Cond), Then(Then), Else(Else) {}
 
   Value* accept(ASTVisitor &V) override { return V.visit(*this); }
+  static bool classof(const ExprAST *E) { return E->getKind() == EK_If; }
 };
 
 /// ForExprAST - Expression class for for/in.
 class ForExprAST : public ExprAST {
 public:
-  std::string VarName;
-  std::unique_ptr<ExprAST> Start, End, Step, Body;
+  Symbol VarName;
+  ExprAST *Start, *End, *Step, *Body; // Step is optional.
 
-  ForExprAST(const std::string &VarName, std::unique_ptr<ExprAST> Start,
-             std::unique_ptr<ExprAST> End, std::unique_ptr<ExprAST> Step,
-             std::unique_ptr<ExprAST> Body,
-             llvm::SMLoc Loc)
-      : ExprAST(Loc), VarName(VarName), Start(std::move(Start)), 
-        End(std::move(End)), Step(std::move(Step)), Body(std::move(Body)) {}
+  ForExprAST(Symbol VarName, ExprAST *Start, ExprAST *End, ExprAST *Step,
+             ExprAST *Body, llvm::SMLoc Loc)
+      : ExprAST(EK_For, Loc), VarName(VarName), Start(Start), End(End),
+        Step(Step), Body(Body) {}
 
   Value* accept(ASTVisitor &V) override { return V.visit(*this); }
+  static bool classof(const ExprAST *E) { return E->getKind() == EK_For; }
 };
 
 /// VarExprAST - Expression class for var/in
 class VarExprAST : public ExprAST {
 public:
-  std::vector<std::pair<std::string, std::unique_ptr<ExprAST>>> VarNames;
-  std::unique_ptr<ExprAST> Body;
+  // Initializers are optional.  Allocated in the ASTContext.
+  llvm::ArrayRef<std::pair<Symbol, ExprAST *>> VarNames;
+  ExprAST *Body;
 
-  VarExprAST(
-      std::vector<std::pair<std::string, std::unique_ptr<ExprAST>>> VarNames,
-      std::unique_ptr<ExprAST> Body, llvm::SMLoc Loc)
-      : ExprAST(Loc), VarNames(std::move(VarNames)), 
-        Body(std::move(Body)) {}
+  VarExprAST(llvm::ArrayRef<std::pair<Symbol, ExprAST *>> VarNames,
+             ExprAST *Body, llvm::SMLoc Loc)
+      : ExprAST(EK_Var, Loc), VarNames(VarNames), Body(Body) {}
 
   Value* accept(ASTVisitor &V) override { return V.visit(*this); }
+  static bool classof(const ExprAST *E) { return E->getKind() == EK_Var; }
 };
 
 /// PrototypeAST - This class represents the "prototype" for a function,
 /// which captures its name, and its argument names (thus implicitly the number
 /// of arguments the function takes), as well as if it is an operator.
+/// Prototypes outlive their definition, so unlike expressions they are
+/// heap allocated.
 class PrototypeAST {
 public:
-  std::string Name;
-  std::vector<std::string> Args;
+  Symbol Name;
+  std::vector<Symbol> Args;
   bool IsOperator;
   unsigned Precedence; // Precedence if a binary op.
 
-  PrototypeAST(const std::string &Name, std::vector<std::string> Args,
+  PrototypeAST(Symbol Name, std::vector<Symbol> Args,
                bool IsOperator = false, unsigned Prec = 0)
       : Name(Name), Args(std::move(Args)), IsOperator(IsOperator),
         Precedence(Prec) {}
 
   Function* accept(ASTVisitor &V) { return V.visit(*this); }
   
-  std::string getName(){ return Name; }
+  Symbol getName() const { return Name; }
 
   bool isUnaryOp() const { return IsOperator && Args.size() == 1; }
   bool isBinaryOp() const { return IsOperator && Args.size() == 2; }
 
   char getOperatorName() const {
     assert(isUnaryOp() || isBinaryOp());
-    return Name[Name.size() - 1];
+    return Name.str().back();
   }
 
   unsigned getBinaryPrecedence() const { return Precedence; }
@@ -187,13 +272,97 @@ public:
 class FunctionAST {
 public:
   std::unique_ptr<PrototypeAST> Proto;
-  std::unique_ptr<ExprAST> Body;
+  ExprAST *Body; // Allocated in the parser's ASTContext.
 
-  FunctionAST(std::unique_ptr<PrototypeAST> Proto,
-              std::unique_ptr<ExprAST> Body)
-      : Proto(std::move(Proto)), Body(std::move(Body)) {}
+  FunctionAST(std::unique_ptr<PrototypeAST> Proto, ExprAST *Body)
+      : Proto(std::move(Proto)), Body(Body) {}
   std::string getName() { return "__anon_expr"; }
   Function* accept(ASTVisitor &V) { return V.visit(*this); }
 };
 
+/// BinOp - Codes of the builtin operators spelled with two characters.  An
+/// operator is stored as a char; for these it is the lexer's token, which
+/// never collides with a character token.
+namespace BinOp {
+constexpr char LE = (char)Token::tok_le;
+constexpr char GE = (char)Token::tok_ge;
+constexpr char EQ = (char)Token::tok_eq;
+constexpr char NE = (char)Token::tok_ne;
+constexpr char And = (char)Token::tok_and;
+constexpr char Or = (char)Token::tok_or;
+} // namespace BinOp
+
+/// isComparisonOp - The builtin comparisons, which yield 0.0 or 1.0.  Like
+/// '<', the ordering ones are unordered compares and hold for NaN operands;
+/// '==' is ordered and '!=' is its negation.
+inline bool isComparisonOp(char Op) {
+  return Op == '<' || Op == '>' || Op == BinOp::LE || Op == BinOp::GE ||
+         Op == BinOp::EQ || Op == BinOp::NE;
+}
+
+/// isLogicalOp - '&&' and '||', which only evaluate their right operand when
+/// the left one does not decide the result and yield 0.0 or 1.0.  An
+/// operand is true when it is non-zero and not NaN, as in an 'if'.
+inline bool isLogicalOp(char Op) { return Op == BinOp::And || Op == BinOp::Or; }
+
+/// isPureBinaryOp - The builtin binary operators.  Codegen lowers them to
+/// plain instructions and branches, so unlike user defined operators they
+/// cannot have side effects of their own.  Once the user defines one, the
+/// parser turns later uses of it into calls of the user's function.
+inline bool isPureBinaryOp(char Op) {
+  return Op == '+' || Op == '-' || Op == '*' || Op == '/' ||
+         isComparisonOp(Op) || isLogicalOp(Op);
+}
+
+/// isBuiltinUnaryOp - '!', logical negation.  It can be redefined like the
+/// builtin binary operators.
+inline bool isBuiltinUnaryOp(char Op) { return Op == '!'; }
+
+inline NumberExprAST *ASTContext::getNumber(double Val, llvm::SMLoc Loc) {
+  if (!Uniquing)
+    return create<NumberExprAST>(Val, Loc);
+  NumberExprAST *&Entry = Numbers[llvm::DoubleToBits(Val)];
+  if (!Entry)
+    Entry = create<NumberExprAST>(Val, Loc);
+  return Entry;
+}
+
+inline VariableExprAST *ASTContext::getVariable(Symbol Name,
+                                                llvm::SMLoc Loc) {
+  if (!Uniquing)
+    return create<VariableExprAST>(Name, Loc);
+  VariableExprAST *&Entry = Variables[Name];
+  if (!Entry)
+    Entry = create<VariableExprAST>(Name, Loc);
+  return Entry;
+}
+
+inline BinaryExprAST *ASTContext::getBinary(char Op, ExprAST *LHS,
+                                            ExprAST *RHS, llvm::SMLoc Loc) {
+  if (!Uniquing || !isPureBinaryOp(Op) || !isPure(LHS) || !isPure(RHS))
+    return create<BinaryExprAST>(Op, LHS, RHS, Loc);
+  BinaryExprAST *&Entry = Binaries[{{LHS, RHS}, Op}];
+  if (!Entry)
+    Entry = create<BinaryExprAST>(Op, LHS, RHS, Loc);
+  return Entry;
+}
+
+inline bool ASTContext::isPure(ExprAST *E) const {
+  if (!Uniquing)
+    return false;
+  switch (E->getKind()) {
+  case ExprAST::EK_Number:
+  case ExprAST::EK_Variable:
+    return true;
+  case ExprAST::EK_Binary: {
+    // Only nodes that went through getBinary are in the table.
+    auto *B = static_cast<BinaryExprAST *>(E);
+    auto I = Binaries.find({{B->LHS, B->RHS}, B->Op});
+    return I != Binaries.end() && I->second == B;
+  }
+  default:
+    return false;
+  }
+}
+
 #endif
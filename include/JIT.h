@@ -3,21 +3,66 @@
 
 #include "KaleidoscopeJIT.h"
 #include "codegen.h"
+#include "optimizer.h"
+#include "tiering.h"
 
 using namespace llvm;
 using namespace llvm::orc;
 
 class JITVisitor : public CodeGenVisitor {
   std::unique_ptr<KaleidoscopeJIT> TheJIT;
+  std::unique_ptr<Optimizer> TheOptimizer;
+  /// Lazy - Compile, and optimize, each definition only when it is first
+  /// called.  Top level expressions are always compiled right away.
+  bool Lazy = false;
+  /// Tiering - In tiered mode, runs definitions unoptimized until they are
+  /// hot.  Declared after TheJIT, so that it is destroyed first.
+  std::unique_ptr<TieredCompiler> Tiering;
+  /// BatchSize - How many top level expressions share a module; at most
+  /// one unless batching.
+  unsigned BatchSize = 1;
+  /// Batch - The thunks of the expressions waiting in TheModule, in order.
+  std::vector<std::string> Batch;
+  unsigned NumThunks = 0;
+  bool PrintIR = false;
+  bool PrintResults = true;
+
+  void runBatch();
 public:
-  JITVisitor(std::unique_ptr<LLVMContext> C, std::unique_ptr<Module> M,
-                  int OptLevel) 
-          :CodeGenVisitor(std::move(C), std::move(M), OptLevel){
-    TheJIT = ExitOnErr(KaleidoscopeJIT::Create());
+  JITVisitor(OperatorTable &Operators, std::unique_ptr<LLVMContext> C,
+                  std::unique_ptr<Module> M, int OptLevel,
+                  JITTargetMachineBuilder JTMB,
+                  const FPOptions &FP = FPOptions(),
+                  ObjectCache *Cache = nullptr)
+          :CodeGenVisitor(Operators, std::move(C), std::move(M), OptLevel){
+    TheJIT = ExitOnErr(KaleidoscopeJIT::Create(std::move(JTMB), Cache));
+    setFPOptions(FP);
     TheModule->setDataLayout(TheJIT->getDataLayout());
+    TheOptimizer = std::make_unique<Optimizer>(OptLevel,
+                                               &TheJIT->getTargetMachine());
   }
   Function* visit(FunctionAST&) override;
 
+  void setLazy(bool Enable);
+  /// setTiered - Compile definitions unoptimized, and recompile those whose
+  /// entries and loop iterations reach Threshold at -O3 in the background.
+  void setTiered(uint64_t Threshold);
+
+  /// setBatch - Compile up to Size consecutive top level expressions in
+  /// one module, as thunks that run in order once it is full, a definition
+  /// follows them, or flush is called.
+  void setBatch(unsigned Size) { BatchSize = Size ? Size : 1; }
+  /// flush - Run the top level expressions still waiting in a batch.
+  void flush();
+  /// setPrintIR - Print the IR of each function as it is generated.
+  void setPrintIR(bool Enable) { PrintIR = Enable; }
+  /// setPrintResults - Print the value of each top level expression.
+  void setPrintResults(bool Enable) { PrintResults = Enable; }
+
+  const JITMemoryPool &getMemoryPool() const {
+    return TheJIT->getMemoryPool();
+  }
+
   void InitializeModuleAndPassManager();
 }; 
 
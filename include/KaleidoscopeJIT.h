@@ -15,17 +15,23 @@
 
 #include "llvm/ADT/StringRef.h"
 #include "llvm/ExecutionEngine/JITSymbol.h"
+#include "llvm/ExecutionEngine/ObjectCache.h"
+#include "jitmemory.h"
+#include "llvm/ExecutionEngine/Orc/CompileOnDemandLayer.h"
 #include "llvm/ExecutionEngine/Orc/CompileUtils.h"
 #include "llvm/ExecutionEngine/Orc/Core.h"
 #include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
 #include "llvm/ExecutionEngine/Orc/IRCompileLayer.h"
+#include "llvm/ExecutionEngine/Orc/IRTransformLayer.h"
 #include "llvm/ExecutionEngine/Orc/JITTargetMachineBuilder.h"
 #include "llvm/ExecutionEngine/Orc/RTDyldObjectLinkingLayer.h"
+#include "llvm/ExecutionEngine/Orc/TPCIndirectionUtils.h"
 #include "llvm/ExecutionEngine/Orc/TargetProcessControl.h"
-#include "llvm/ExecutionEngine/SectionMemoryManager.h"
 #include "llvm/IR/DataLayout.h"
 #include "llvm/IR/LLVMContext.h"
 #include <memory>
+#include <string>
+#include <vector>
 
 namespace llvm {
 namespace orc {
@@ -34,26 +40,56 @@ class KaleidoscopeJIT {
 private:
   std::unique_ptr<TargetProcessControl> TPC;
   std::unique_ptr<ExecutionSession> ES;
+  /// TPCIU - The stubs and the lazy call-through trampolines of lazily
+  /// compiled functions.
+  std::unique_ptr<TPCIndirectionUtils> TPCIU;
 
   DataLayout DL;
   MangleAndInterner Mangle;
 
+  /// MemoryPool - Where every object is linked.  Declared before the
+  /// object layer, whose memory managers return their blocks to it.
+  JITMemoryPool MemoryPool;
   RTDyldObjectLinkingLayer ObjectLayer;
   IRCompileLayer CompileLayer;
+  /// LazyTransformLayer - Applied to lazily compiled code when it is
+  /// compiled, e.g. to defer IR optimization too.
+  IRTransformLayer LazyTransformLayer;
+  CompileOnDemandLayer CODLayer;
 
   JITDylib &MainJD;
 
+  /// TM - Describes the code the compile layer produces, for the IR
+  /// optimizer's cost models.
+  std::unique_ptr<TargetMachine> TM;
+
+  static void handleLazyCallThroughError() {
+    errs() << "LazyCallThrough error: Could not find function body";
+    exit(1);
+  }
+
 public:
   KaleidoscopeJIT(std::unique_ptr<TargetProcessControl> TPC,
                   std::unique_ptr<ExecutionSession> ES,
-                  JITTargetMachineBuilder JTMB, DataLayout DL)
-      : TPC(std::move(TPC)), ES(std::move(ES)), DL(std::move(DL)),
-        Mangle(*this->ES, this->DL),
+                  std::unique_ptr<TPCIndirectionUtils> TPCIU,
+                  JITTargetMachineBuilder JTMB, DataLayout DL,
+                  std::unique_ptr<TargetMachine> TM,
+                  ObjectCache *Cache = nullptr)
+      : TPC(std::move(TPC)), ES(std::move(ES)), TPCIU(std::move(TPCIU)),
+        DL(std::move(DL)), Mangle(*this->ES, this->DL),
         ObjectLayer(*this->ES,
-                    []() { return std::make_unique<SectionMemoryManager>(); }),
+                    [this]() {
+                      return std::make_unique<PooledMemoryManager>(
+                          MemoryPool);
+                    }),
         CompileLayer(*this->ES, ObjectLayer,
-                     std::make_unique<ConcurrentIRCompiler>(std::move(JTMB))),
-        MainJD(this->ES->createBareJITDylib("<main>")) {
+                     std::make_unique<ConcurrentIRCompiler>(std::move(JTMB),
+                                                            Cache)),
+        LazyTransformLayer(*this->ES, CompileLayer),
+        CODLayer(*this->ES, LazyTransformLayer,
+                 this->TPCIU->getLazyCallThroughManager(),
+                 [this] { return this->TPCIU->createIndirectStubsManager(); }),
+        MainJD(this->ES->createBareJITDylib("<main>")), TM(std::move(TM)) {
     MainJD.addGenerator(
         cantFail(DynamicLibrarySearchGenerator::GetForCurrentProcess(
             DL.getGlobalPrefix())));
@@ -62,9 +98,25 @@ public:
   ~KaleidoscopeJIT() {
     if (auto Err = ES->endSession())
       ES->reportError(std::move(Err));
+    if (auto Err = TPCIU->cleanup())
+      ES->reportError(std::move(Err));
   }
 
+  /// Create - A JIT for this process that compiles for the host CPU and
+  /// all of its features.
   static Expected<std::unique_ptr<KaleidoscopeJIT>> Create() {
+    auto JTMB = JITTargetMachineBuilder::detectHost();
+    if (!JTMB)
+      return JTMB.takeError();
+    return Create(std::move(*JTMB));
+  }
+
+  /// Create - A JIT for this process whose code generator is configured by
+  /// JTMB, which must describe a target the process can run.  If Cache is
+  /// given, it is asked for each module's object before compiling it, and
+  /// must outlive the JIT.
+  static Expected<std::unique_ptr<KaleidoscopeJIT>>
+  Create(JITTargetMachineBuilder JTMB, ObjectCache *Cache = nullptr) {
     auto SSP = std::make_shared<SymbolStringPool>();
     auto TPC = SelfTargetProcessControl::Create(SSP);
     if (!TPC)
@@ -72,29 +124,89 @@ public:
 
     auto ES = std::make_unique<ExecutionSession>(std::move(SSP));
 
-    JITTargetMachineBuilder JTMB((*TPC)->getTargetTriple());
+    auto TPCIU = TPCIndirectionUtils::Create(**TPC);
+    if (!TPCIU)
+      return TPCIU.takeError();
+    (*TPCIU)->createLazyCallThroughManager(
+        *ES, pointerToJITTargetAddress(&handleLazyCallThroughError));
+    if (auto Err = setUpInProcessLCTMReentryViaTPCIU(**TPCIU))
+      return std::move(Err);
 
     auto DL = JTMB.getDefaultDataLayoutForTarget();
     if (!DL)
       return DL.takeError();
 
-    return std::make_unique<KaleidoscopeJIT>(std::move(*TPC), std::move(ES),
-                                             std::move(JTMB), std::move(*DL));
+    auto TM = JTMB.createTargetMachine();
+    if (!TM)
+      return TM.takeError();
+
+    return std::make_unique<KaleidoscopeJIT>(
+        std::move(*TPC), std::move(ES), std::move(*TPCIU), std::move(JTMB),
+        std::move(*DL), std::move(*TM), Cache);
   }
 
   const DataLayout &getDataLayout() const { return DL; }
 
+  TargetMachine &getTargetMachine() { return *TM; }
+
   JITDylib &getMainJITDylib() { return MainJD; }
 
+  const JITMemoryPool &getMemoryPool() const { return MemoryPool; }
+
   Error addModule(ThreadSafeModule TSM, ResourceTrackerSP RT = nullptr) {
     if (!RT)
       RT = MainJD.getDefaultResourceTracker();
     return CompileLayer.add(RT, std::move(TSM));
   }
 
+  /// addLazyModule - Like addModule, but each function is only compiled,
+  /// through the lazy transform, when it is first called.  Until then its
+  /// symbol is a stub that jumps to the compiler.
+  Error addLazyModule(ThreadSafeModule TSM, ResourceTrackerSP RT = nullptr) {
+    if (!RT)
+      RT = MainJD.getDefaultResourceTracker();
+    return CODLayer.add(RT, std::move(TSM));
+  }
+
+  /// createIndirectStubsManager - A new, empty set of stubs whose targets
+  /// can be changed while JIT'd code runs.
+  std::unique_ptr<IndirectStubsManager> createIndirectStubsManager() {
+    return TPCIU->createIndirectStubsManager();
+  }
+
+  /// defineAbsolute - Make Name resolve to the existing address Sym.
+  Error defineAbsolute(StringRef Name, JITEvaluatedSymbol Sym) {
+    return MainJD.define(absoluteSymbols({{Mangle(Name.str()), Sym}}));
+  }
+
+  /// setLazyTransform - Apply Transform to each lazily compiled module right
+  /// before it is compiled.
+  void setLazyTransform(IRTransformLayer::TransformFunction Transform) {
+    LazyTransformLayer.setTransform(std::move(Transform));
+  }
+
   Expected<JITEvaluatedSymbol> lookup(StringRef Name) {
     return ES->lookup({&MainJD}, Mangle(Name.str()));
   }
+
+  /// lookupAll - The symbols Names, in order, found in a single query.
+  Expected<std::vector<JITEvaluatedSymbol>>
+  lookupAll(ArrayRef<std::string> Names) {
+    std::vector<SymbolStringPtr> Mangled;
+    SymbolLookupSet Symbols;
+    for (const std::string &Name : Names) {
+      Mangled.push_back(Mangle(Name));
+      Symbols.add(Mangled.back());
+    }
+    auto Found = ES->lookup(makeJITDylibSearchOrder(&MainJD),
+                            std::move(Symbols));
+    if (!Found)
+      return Found.takeError();
+    std::vector<JITEvaluatedSymbol> Result;
+    for (const SymbolStringPtr &Name : Mangled)
+      Result.push_back((*Found)[Name]);
+    return Result;
+  }
 };
 
 } // end namespace orc
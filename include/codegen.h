@@ -1,7 +1,12 @@
 #ifndef __CODEGEN_H__
 #define __CODEGEN_H__
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/ScopedHashTable.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
 #include "llvm/ADT/STLExtras.h"
 #include "llvm/ADT/Optional.h"
+#include "llvm/ADT/StringMap.h"
 #include "llvm/IR/BasicBlock.h"
 #include "llvm/IR/Constants.h"
 #include "llvm/IR/DerivedTypes.h"
@@ -9,7 +14,6 @@
 #include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/Instructions.h"
 #include "llvm/IR/LLVMContext.h"
-#include "llvm/IR/LegacyPassManager.h"
 #include "llvm/IR/Module.h"
 #include "llvm/IR/Type.h"
 #include "llvm/IR/Verifier.h"
@@ -17,40 +21,107 @@
 
 #include <memory>
 #include "../include/AST.h"
+#include "../include/fpoptions.h"
+#include "../include/operators.h"
+#include "../include/purity.h"
+#include "../include/typeinference.h"
 
 using namespace llvm;
 
 class CodeGenVisitor : public ASTVisitor {
     llvm::SourceMgr *SrcMgr = nullptr;
+protected:
+    /// OptLevel - The -O level, encoded as for Optimizer.
     int OptLevel = 0;
+    /// Remarks - Report every tail call turned into a loop.
+    bool Remarks = false;
+    /// FP - How strictly floating point code follows IEEE 754.  Builder
+    /// puts the matching fast-math flags on every instruction it creates.
+    FPOptions FP;
+    /// Operators - The session's operator table, where definitions of binary
+    /// operators are installed for the parser.
+    OperatorTable &Operators;
 public:
     std::unique_ptr<LLVMContext> TheContext;
     std::unique_ptr<Module> TheModule;
     std::unique_ptr<IRBuilder<>> Builder;
 
-    std::map<std::string, AllocaInst *> NamedValues;
-    std::unique_ptr<legacy::FunctionPassManager> TheFPM;
-    std::map<std::string, std::unique_ptr<PrototypeAST>> FunctionProtos;
+    /// NamedValues - The variables in scope, keyed by interned name.  The
+    /// function, each for loop and each var/in open a scope of their own;
+    /// inner bindings shadow outer ones until the scope is closed.
+    using VarScope = ScopedHashTableScope<Symbol, AllocaInst *>;
+    ScopedHashTable<Symbol, AllocaInst *> NamedValues;
+
+    /// ExprCache - Values of the pure expressions emitted so far, keyed by
+    /// node so that a subtree shared by a hash-consed AST is emitted once.
+    /// There is one frame per region whose code dominates everything emitted
+    /// after it until the frame is popped (an if arm, a loop, a var scope).
+    /// Only consulted when ShareExprs is set; otherwise no node is shared.
+    SmallVector<DenseMap<ExprAST *, Value *>, 4> ExprCache;
+    bool ShareExprs = false;
+    Value *lookupExpr(ExprAST *E);
+    void rememberExpr(ExprAST *E, Value *V);
+    void pushExprScope() { ExprCache.emplace_back(); }
+    void popExprScope() { ExprCache.pop_back(); }
+    /// invalidateExprs - Forget every cached value.  Needed whenever a store
+    /// or a new binding may change what a variable read yields.
+    void invalidateExprs();
+
+    /// Types - Which expressions of the current function are emitted as i1
+    /// or i64 instead of double.  Each visit returns a value of the type
+    /// its node was given; convert() is applied where a double (or, for
+    /// branches, an i1) is required.
+    TypeInference Types;
+    Type *getType(TypeInference::TypeKind Kind);
+    Value *convert(Value *V, Type *To);
+    Value *toDouble(Value *V) {
+        return convert(V, Type::getDoubleTy(*TheContext));
+    }
+
+    /// Self tail calls of the function being emitted are branches back to
+    /// TailRecurseBB, the block right after the one that spills the
+    /// arguments into ParamAllocas, so recursion of any depth runs in
+    /// constant stack space whatever the optimization level.
+    PrototypeAST *CurProto = nullptr;
+    SmallVector<AllocaInst *, 4> ParamAllocas;
+    BasicBlock *TailRecurseBB = nullptr;
+    SmallPtrSet<CallExprAST *, 4> TailCalls;
+    void collectTailCalls(ExprAST *E);
+    Value *emitTailRecursion(CallExprAST &Node);
+
+    /// Purity - Which functions defined so far have no side effects.
+    /// Their definitions and declarations, in any module, carry the
+    /// matching attributes.
+    PurityAnalysis Purity;
+    void addEffectAttrs(Function &F);
+
+    Value *emitBinaryOp(BinaryExprAST &Node, Value *L, Value *R);
+    Value *emitLogical(BinaryExprAST &Node);
+    Value *emitCountedLoop(ForExprAST &Node, AllocaInst *Alloca,
+                           int64_t Start, int64_t Step, ExprAST *Bound);
+
+    StringMap<std::unique_ptr<PrototypeAST>> FunctionProtos;
     ExitOnError ExitOnErr;
 
-    Function* getFunction(std::string);
-    AllocaInst *CreateEntryBlockAlloca(Function *TheFunction, StringRef VarName);
+    Function* getFunction(StringRef);
+    AllocaInst *CreateEntryBlockAlloca(Function *TheFunction, StringRef VarName,
+                                       Type *Ty = nullptr);
     
-    CodeGenVisitor(llvm::SourceMgr *SrcMgr, std::unique_ptr<LLVMContext> C, 
+    CodeGenVisitor(llvm::SourceMgr *SrcMgr, OperatorTable &Operators,
+                    std::unique_ptr<LLVMContext> C,
                     std::unique_ptr<Module> M, int OptLevel)
-            : SrcMgr(SrcMgr), OptLevel(OptLevel),
+            : SrcMgr(SrcMgr), OptLevel(OptLevel), Operators(Operators),
             TheContext(std::move(C)), TheModule(std::move(M)){
         // Create a new builder for the module.
         Builder = std::make_unique<IRBuilder<>>(*TheContext);
-        InitOptimPassManager();    
     }
     
-    CodeGenVisitor(std::unique_ptr<LLVMContext> C, std::unique_ptr<Module> M,
-                    int OptLevel)
-            : OptLevel(OptLevel), TheContext(std::move(C)), TheModule(std::move(M)) {
+    CodeGenVisitor(OperatorTable &Operators, std::unique_ptr<LLVMContext> C,
+                    std::unique_ptr<Module> M, int OptLevel)
+            : OptLevel(OptLevel), Operators(Operators),
+            TheContext(std::move(C)), TheModule(std::move(M)) {
         // Create a new builder for the module.
         Builder = std::make_unique<IRBuilder<>>(*TheContext);
-        InitOptimPassManager();    
     }
     
     Value* visit(NumberExprAST&) override;
@@ -64,9 +135,17 @@ public:
     Function* visit(PrototypeAST&) override;
     virtual Function* visit(FunctionAST&) override; 
     
-    void InitOptimPassManager();
+    void setRemarks(bool Enable) { Remarks = Enable; }
+    /// setExprSharing - Emit each shared node once per scope.  Set it when
+    /// the parser hash-conses.
+    void setExprSharing(bool Enable) { ShareExprs = Enable; }
+    void setFPOptions(const FPOptions &Options) {
+        FP = Options;
+        Builder->setFastMathFlags(FP.getFastMathFlags());
+    }
 
     Value *LogErrorV(llvm::SMLoc, const char *Str);
+    void LogRemark(llvm::SMLoc, const Twine &Msg);
 };
 
 
@@ -0,0 +1,75 @@
+#ifndef __FPOPTIONS_H__
+#define __FPOPTIONS_H__
+
+#include "llvm/IR/Function.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/Target/TargetOptions.h"
+
+/// FPOptions - Which IEEE 754 guarantees floating point code may give up
+/// for speed, as set by the driver's -ffast-math family of flags.  The
+/// default is strict IEEE semantics.
+///
+/// The IR optimizer learns them from the fast-math flags on each
+/// instruction, the code generator from its TargetOptions and from the
+/// attributes of each function, so all three are set from one FPOptions.
+struct FPOptions {
+  bool Reassoc = false;         // -fassociative-math
+  bool AllowReciprocal = false; // -freciprocal-math
+  bool NoSignedZeros = false;   // -fno-signed-zeros
+  bool NoNaNs = false;          // -fno-honor-nans
+  bool NoInfs = false;          // -fno-honor-infinities
+  bool ApproxFunc = false;      // -fapprox-func
+  bool Contract = false;        // -ffp-contract=fast
+
+  /// setFast - Give up every guarantee, as -ffast-math does.
+  void setFast() {
+    Reassoc = AllowReciprocal = NoSignedZeros = NoNaNs = NoInfs =
+        ApproxFunc = Contract = true;
+  }
+
+  /// isUnsafe - Whether the value-changing transforms the code generator
+  /// calls unsafe-fp-math are all allowed.
+  bool isUnsafe() const {
+    return Reassoc && AllowReciprocal && NoSignedZeros;
+  }
+
+  llvm::FastMathFlags getFastMathFlags() const {
+    llvm::FastMathFlags FMF;
+    FMF.setAllowReassoc(Reassoc);
+    FMF.setAllowReciprocal(AllowReciprocal);
+    FMF.setNoSignedZeros(NoSignedZeros);
+    FMF.setNoNaNs(NoNaNs);
+    FMF.setNoInfs(NoInfs);
+    FMF.setApproxFunc(ApproxFunc);
+    FMF.setAllowContract(Contract);
+    return FMF;
+  }
+
+  /// apply - Relax Options accordingly.  Guarantees already given up in
+  /// Options, e.g. by -enable-unsafe-fp-math, stay given up.
+  void apply(llvm::TargetOptions &Options) const {
+    Options.UnsafeFPMath |= isUnsafe();
+    Options.NoNaNsFPMath |= NoNaNs;
+    Options.NoInfsFPMath |= NoInfs;
+    Options.NoSignedZerosFPMath |= NoSignedZeros;
+    if (Contract)
+      Options.AllowFPOpFusion = llvm::FPOpFusion::Fast;
+  }
+
+  /// apply - Record the relaxed guarantees on the definition F, for the
+  /// code generator's per-function options.
+  void apply(llvm::Function &F) const {
+    auto Set = [&](const char *Kind, bool Value) {
+      if (Value)
+        F.addFnAttr(Kind, "true");
+    };
+    Set("unsafe-fp-math", isUnsafe());
+    Set("no-nans-fp-math", NoNaNs);
+    Set("no-infs-fp-math", NoInfs);
+    Set("no-signed-zeros-fp-math", NoSignedZeros);
+    Set("approx-func-fp-math", ApproxFunc);
+    Set("less-precise-fpmad", Contract);
+  }
+};
+
+#endif
@@ -0,0 +1,133 @@
+#ifndef __JITMEMORY_H__
+#define __JITMEMORY_H__
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ExecutionEngine/RTDyldMemoryManager.h"
+#include "llvm/Support/Memory.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/// JITMemoryPool - Page aligned blocks for the JIT's objects, carved from
+/// large slabs that stay mapped until the pool is destroyed.
+///
+/// Freed blocks are kept on a free list per size class and kind and handed
+/// out again, so an object that lives for one top level expression costs
+/// no mmap or munmap, only the protection changes of its code and
+/// read-only data.  Protected blocks stay so while free and only become
+/// writable again when they are reused.
+///
+/// The object layer may link on several threads.
+class JITMemoryPool {
+public:
+  /// Kind - What a block holds, which decides its final protection: code
+  /// is read-execute, read-only data read-only and data read-write.
+  enum Kind { Code, ROData, Data, NumKinds };
+
+  struct Block {
+    uint8_t *Addr = nullptr;
+    size_t Size = 0;
+    Kind K = Data;
+    /// Protected - Whether the block currently has the final protection
+    /// of its kind rather than read-write.
+    bool Protected = false;
+  };
+
+  struct Stats {
+    uint64_t MappedBytes = 0;
+    uint64_t InUseBytes = 0;
+    uint64_t PeakInUseBytes = 0;
+    uint64_t Allocations = 0;
+    uint64_t Reuses = 0;
+    uint64_t Protections = 0;
+  };
+
+private:
+  /// SlabSize - Bytes mapped at once, unless a block needs more.
+  static constexpr size_t SlabSize = 1 << 20;
+  /// NumClasses - Block sizes are a power of two pages; bigger requests
+  /// than the last class are rounded to pages and never reused.
+  static constexpr unsigned NumClasses = 12;
+
+  size_t PageSize;
+  std::vector<llvm::sys::MemoryBlock> Slabs;
+  uint8_t *SlabNext = nullptr;
+  uint8_t *SlabEnd = nullptr;
+  std::vector<Block> FreeLists[NumKinds][NumClasses];
+  Stats Counters;
+  mutable std::mutex Mutex;
+
+  unsigned getClass(size_t Pages) const;
+  uint8_t *carve(size_t Size, std::error_code &EC);
+
+public:
+  JITMemoryPool();
+  JITMemoryPool(const JITMemoryPool &) = delete;
+  JITMemoryPool &operator=(const JITMemoryPool &) = delete;
+  ~JITMemoryPool();
+
+  /// allocate - A read-write block of at least Size bytes for K.
+  llvm::Expected<Block> allocate(size_t Size, Kind K);
+  /// release - Return B to the pool.
+  void release(Block B);
+  /// protect - Give the code or read-only data block B its final
+  /// protection.
+  std::error_code protect(Block &B);
+
+  Stats getStats() const {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    return Counters;
+  }
+  void printStats(llvm::raw_ostream &OS) const;
+};
+
+/// PooledMemoryManager - The memory of one object linked by the JIT, taken
+/// from a JITMemoryPool and returned to it when the object is removed.
+///
+/// Code and read-only data get blocks of their own, so that data is never
+/// executable.  RuntimeDyld reserves the space of all sections up front;
+/// sections it allocates later get blocks of their own.
+class PooledMemoryManager : public llvm::RTDyldMemoryManager {
+  /// Region - The unused rest of the latest block of a kind.
+  struct Region {
+    uint8_t *Next = nullptr;
+    uint8_t *End = nullptr;
+  };
+
+  JITMemoryPool &Pool;
+  llvm::SmallVector<JITMemoryPool::Block, 4> Blocks;
+  Region Regions[JITMemoryPool::NumKinds];
+  /// AllocError - The first allocation failure, reported by
+  /// finalizeMemory.
+  std::string AllocError;
+
+  uint8_t *allocate(uintptr_t Size, unsigned Alignment, JITMemoryPool::Kind K);
+  bool grow(uintptr_t Size, JITMemoryPool::Kind K);
+
+public:
+  explicit PooledMemoryManager(JITMemoryPool &Pool) : Pool(Pool) {}
+  PooledMemoryManager(const PooledMemoryManager &) = delete;
+  PooledMemoryManager &operator=(const PooledMemoryManager &) = delete;
+  ~PooledMemoryManager() override;
+
+  bool needsToReserveAllocationSpace() override { return true; }
+  void reserveAllocationSpace(uintptr_t CodeSize, uint32_t CodeAlign,
+                              uintptr_t RODataSize, uint32_t RODataAlign,
+                              uintptr_t RWDataSize,
+                              uint32_t RWDataAlign) override;
+
+  uint8_t *allocateCodeSection(uintptr_t Size, unsigned Alignment,
+                               unsigned SectionID,
+                               llvm::StringRef SectionName) override;
+  uint8_t *allocateDataSection(uintptr_t Size, unsigned Alignment,
+                               unsigned SectionID, llvm::StringRef SectionName,
+                               bool IsReadOnly) override;
+
+  bool finalizeMemory(std::string *ErrMsg = nullptr) override;
+};
+
+#endif
@@ -2,11 +2,15 @@
 #define __LEXER_H__
 
 #include <string>
+#include <vector>
 #include "llvm/ADT/StringMap.h"
 #include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/Twine.h"
 #include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/SourceMgr.h"
 #include "llvm/Support/SMLoc.h"
+#include "scan.h"
+#include "symbol.h"
 
 namespace Token {
 enum TokenID {
@@ -32,24 +36,66 @@ enum TokenID {
   tok_unary = -12,
 
   // var definition
-  tok_var = -13
+  tok_var = -13,
+
+  // two character operators
+  tok_le = -14,  // <=
+  tok_ge = -15,  // >=
+  tok_eq = -16,  // ==
+  tok_ne = -17,  // !=
+  tok_and = -18, // &&
+  tok_or = -19,  // ||
+
+  // a malformed token, already diagnosed by the lexer
+  tok_error = -20
 };
+
+/// getKeyword - Classify an identifier spelling, returning the keyword token
+/// or tok_identifier.
+int getKeyword(llvm::StringRef Spelling);
+
+/// parseNumber - Convert a [0-9.]+ spelling to the nearest double without
+/// allocating or consulting the C locale.  Returns false if the spelling is
+/// malformed (no digits, or more than one '.'); Result then holds the value
+/// of the longest well-formed prefix, and the lexer returns tok_error.
+bool parseNumber(llvm::StringRef Spelling, double &Result);
     
 }
 
 class Lexer {
+protected:
+    SymbolTable Symbols;
+    Symbol IdentifierSym;          // Filled in if tok_identifier
+    const scan::Scanner *Scan = &scan::getHostScanner();
+
+    /// lexToken - Lex the identifier, number or character token at CurPtr,
+    /// which must not be whitespace or a comment.  The token must be
+    /// complete in the buffer, which ends at a '\n' or a '\0' sentinel.
+    int lexToken(const char *&CurPtr);
 public:
-    std::string IdentifierStr = ""; // Filled in if tok_identifier
     double NumVal = 0;             // Filled in if tok_number
     virtual ~Lexer() {};  
     virtual int gettok() = 0;
     virtual llvm::SMLoc getLocation() = 0;
+
+    /// printError - Report a diagnostic at Loc, with source context if the
+    /// lexer has any.
+    virtual void printError(llvm::SMLoc Loc, const llvm::Twine &Msg);
+
+    /// getIdentifier - The interned name of the last tok_identifier.
+    Symbol getIdentifier() const { return IdentifierSym; }
+    SymbolTable &getSymbols() { return Symbols; }
+
+    /// setScanner - Override the host-selected whitespace/comment scanner.
+    void setScanner(const scan::Scanner &S) { Scan = &S; }
 };
 
-class LexerFile : public Lexer {
+class LexerFile final : public Lexer {
   
   llvm::SourceMgr& SrcMgr;
   const char *CurPtr;
+  /// TokStart - Start of the token last returned by gettok().
+  const char *TokStart;
   llvm::StringRef CurBuf;
   /// CurBuffer - This is the current buffer index we're
   /// lexing from as managed by the SourceMgr object.
@@ -61,14 +107,39 @@ public:
     int gettok() override;
 
     llvm::SMLoc getLocation() override { return llvm::SMLoc::getFromPointer(CurPtr); }
+    void printError(llvm::SMLoc Loc, const llvm::Twine &Msg) override;
     llvm::SourceMgr &getSourceMgr() { return SrcMgr; }
+    llvm::StringRef getBuffer() const { return CurBuf; }
+    const char *getTokenStart() const { return TokStart; }
 };
 
+/// LexerSimple - Lexes a stream such as stdin or a pipe.  Input is read in
+/// large chunks into a window that is compacted and reused as it is
+/// consumed; only whole lines are lexed, so no token is ever split across a
+/// refill and the same code as LexerFile can be used.
 class LexerSimple : public Lexer {
+  int FD;
+  std::string BufferName;
+  std::vector<char> Buffer;
+  const char *CurPtr;
+  /// Avail - End of the buffered text that holds only complete lines.
+  const char *Avail;
+  /// BufEnd - End of the buffered text, always followed by a '\0'.
+  const char *BufEnd;
+  /// BaseLine - Line number of the first line in Buffer.
+  unsigned BaseLine = 1;
+  bool AtEOF = false;
+  /// DiagSrcMgr - Only used to format diagnostics.
+  llvm::SourceMgr DiagSrcMgr;
+
+  bool refill();
+
 public:
-    LexerSimple(){}
+    /// LexerSimple - Lex the stream read from FD, stdin by default.
+    LexerSimple(int FD = 0, llvm::StringRef BufferName = "<stdin>");
     int gettok() override;
-    llvm::SMLoc getLocation() override { return llvm::SMLoc(); }
+    llvm::SMLoc getLocation() override { return llvm::SMLoc::getFromPointer(CurPtr); }
+    void printError(llvm::SMLoc Loc, const llvm::Twine &Msg) override;
 };
 
 #endif
@@ -0,0 +1,28 @@
+#ifndef __MULTIVERSION_H__
+#define __MULTIVERSION_H__
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Error.h"
+
+#include <string>
+
+/// multiversion - Compile every function M exports once per x86-64
+/// micro-architecture level in Levels ("x86-64", "x86-64-v2", "x86-64-v3"
+/// or "x86-64-v4") and let the dynamic loader pick one per process.
+///
+/// Each version is an internal copy of the function named
+/// "<function>.<level>" whose "target-cpu" is the level, and whose calls to
+/// other exported functions go straight to their version for the same
+/// level.  The exported name becomes an ifunc whose resolver returns the
+/// version for the highest level the CPU supports, whatever the order of
+/// Levels.  The baseline "x86-64" is always among the versions, so that
+/// every CPU has one.  The resolver reads the CPU features that libgcc and
+/// compiler-rt record in __cpu_model, so the host must link against one of
+/// them, as every C or C++ program does.
+///
+/// Only ELF targets support ifuncs.  The program entry point "main" is
+/// left alone.
+llvm::Error multiversion(llvm::Module &M, llvm::ArrayRef<std::string> Levels);
+
+#endif
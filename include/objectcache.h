@@ -0,0 +1,85 @@
+#ifndef __OBJECTCACHE_H__
+#define __OBJECTCACHE_H__
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ExecutionEngine/ObjectCache.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/Error.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+
+/// DiskObjectCache - Keeps the objects the JIT compiles in a directory, so
+/// that a later session compiling the same module loads the object instead
+/// of running the code generator.
+///
+/// An object is keyed by the SHA1 of the module's bitcode and of a salt
+/// that must describe everything else the object depends on: the target
+/// triple, CPU and features, the back end optimization level and the LLVM
+/// version.  Once the directory holds more than MaxBytes of objects, the
+/// least recently used ones are deleted.  Recency survives sessions as the
+/// files' modification times.
+///
+/// Modules that only define the thunks of top level expressions
+/// ("__anon_expr..."), like REPL queries and batches of them, are neither
+/// looked up nor stored: they rarely repeat, and hashing and writing each
+/// one would cost more than compiling it.
+///
+/// The compile layer may call it from several threads.
+class DiskObjectCache : public llvm::ObjectCache {
+public:
+  struct Stats {
+    uint64_t Hits = 0;
+    uint64_t Misses = 0;
+    uint64_t Evictions = 0;
+  };
+
+private:
+  std::string Dir;
+  uint64_t MaxBytes;
+  std::string Salt;
+
+  struct Entry {
+    std::string Key;
+    uint64_t Size;
+  };
+  /// LRU - The objects in the directory, least recently used first.
+  std::list<Entry> LRU;
+  llvm::StringMap<std::list<Entry>::iterator> Index;
+  uint64_t TotalBytes = 0;
+  Stats Counters;
+  mutable std::mutex Mutex;
+
+  DiskObjectCache(llvm::StringRef Dir, uint64_t MaxBytes,
+                  llvm::StringRef Salt)
+      : Dir(Dir.str()), MaxBytes(MaxBytes), Salt(Salt.str()) {}
+
+  std::string getKey(const llvm::Module &M) const;
+  std::string getPath(llvm::StringRef Key) const;
+  llvm::Error scan();
+  void insert(llvm::StringRef Key, uint64_t Size);
+  void evict();
+
+public:
+  /// create - A cache in Dir, which is created if needed, and whose
+  /// existing objects are reused.
+  static llvm::Expected<std::unique_ptr<DiskObjectCache>>
+  create(llvm::StringRef Dir, uint64_t MaxBytes, llvm::StringRef Salt);
+
+  void notifyObjectCompiled(const llvm::Module *M,
+                            llvm::MemoryBufferRef Obj) override;
+  std::unique_ptr<llvm::MemoryBuffer> getObject(const llvm::Module *M) override;
+
+  Stats getStats() const {
+    std::lock_guard<std::mutex> Lock(Mutex);
+    return Counters;
+  }
+  void printStats(llvm::raw_ostream &OS) const;
+};
+
+#endif
@@ -0,0 +1,79 @@
+#ifndef __OPERATORS_H__
+#define __OPERATORS_H__
+
+#include "lexer.h"
+
+/// OperatorTable - The binary operators known to one compilation session and
+/// their precedences, and the operators the user defined.  The parser
+/// consults it for every token and code generation installs user defined
+/// operators into it, so each Parser/CodeGenVisitor pair shares one table
+/// and separate sessions can run on separate threads.  Lookup is a single
+/// array load.
+class OperatorTable {
+  /// Precedence of each operator, 0 if it is not one.  Operators are
+  /// indexed by their char code, two character ones by their (negative)
+  /// token value.
+  int BinaryPrecedence[256];
+  /// UserBinary, UserUnary - Whether the user defined each operator.  A
+  /// user definition of a builtin operator replaces it.
+  bool UserBinary[256] = {};
+  bool UserUnary[256] = {};
+
+  /// getDefaultPrecedence - Precedence of the builtin operator Tok, 0 if
+  /// it is not one.  1 is lowest precedence.
+  static int getDefaultPrecedence(int Tok) {
+    switch (Tok) {
+    case '=':             return 2;
+    case Token::tok_or:   return 5;
+    case Token::tok_and:  return 6;
+    case Token::tok_eq:
+    case Token::tok_ne:   return 9;
+    case '<':
+    case '>':
+    case Token::tok_le:
+    case Token::tok_ge:   return 10;
+    case '+':
+    case '-':             return 20;
+    case '*':
+    case '/':             return 40; // highest.
+    default:              return 0;
+    }
+  }
+
+  static unsigned char getIndex(char Op) { return (unsigned char)Op; }
+
+public:
+  OperatorTable() {
+    // Install standard binary operators.
+    for (int Tok = -128; Tok != 128; ++Tok)
+      BinaryPrecedence[getIndex(Tok)] = getDefaultPrecedence(Tok);
+  }
+
+  /// getBinaryPrecedence - Precedence of the token Tok as a binary operator,
+  /// or 0 if it is not one.  Tok may be any token value.
+  int getBinaryPrecedence(int Tok) const {
+    return Tok >= -128 && Tok < 128 ? BinaryPrecedence[getIndex(Tok)] : 0;
+  }
+
+  /// addBinary - Install the user defined binary operator Op.
+  void addBinary(char Op, int Prec) {
+    BinaryPrecedence[getIndex(Op)] = Prec;
+    UserBinary[getIndex(Op)] = true;
+  }
+
+  /// removeBinary - Forget a user definition of Op.  A builtin operator
+  /// gets its default precedence and meaning back.
+  void removeBinary(char Op) {
+    BinaryPrecedence[getIndex(Op)] = getDefaultPrecedence((signed char)Op);
+    UserBinary[getIndex(Op)] = false;
+  }
+
+  void addUnary(char Op) { UserUnary[getIndex(Op)] = true; }
+  void removeUnary(char Op) { UserUnary[getIndex(Op)] = false; }
+
+  /// isUserBinary, isUserUnary - Whether the user defined Op.
+  bool isUserBinary(char Op) const { return UserBinary[getIndex(Op)]; }
+  bool isUserUnary(char Op) const { return UserUnary[getIndex(Op)]; }
+};
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef __OPTIMIZER_H__
+#define __OPTIMIZER_H__
+
+#include "llvm/IR/Module.h"
+#include "llvm/IR/PassManager.h"
+#include "llvm/Passes/PassBuilder.h"
+#include "llvm/Target/TargetMachine.h"
+
+/// Optimizer - Runs LLVM's default new pass manager pipeline for one
+/// optimization level over whole modules.  OptLevel uses the driver's
+/// encoding: 0 to 3 for -O0..-O3, -1 for -Os and -2 for -Oz.  TM, if given,
+/// supplies the target's cost model to the pipeline.
+class Optimizer {
+    int OptLevel;
+    // The analysis managers refer to the PassBuilder, so it must outlive
+    // them.
+    llvm::PassBuilder PB;
+    llvm::LoopAnalysisManager LAM;
+    llvm::FunctionAnalysisManager FAM;
+    llvm::CGSCCAnalysisManager CGAM;
+    llvm::ModuleAnalysisManager MAM;
+    llvm::ModulePassManager MPM;
+
+public:
+    Optimizer(int OptLevel, llvm::TargetMachine *TM = nullptr);
+
+    /// run - Optimize M.  A no-op at -O0.
+    void run(llvm::Module &M);
+};
+
+#endif
@@ -3,47 +3,78 @@
 
 #include <memory>
 #include <map>
+#include <vector>
+
+#include "llvm/Support/SMLoc.h"
+#include "AST.h"
+#include "operators.h"
+#include "symbol.h"
 
 class Lexer;
-class ASTVisitor;
-class ExprAST;
-class PrototypeAST;
-class FunctionAST;
+class TokenStream;
 
 class Parser {
     Lexer* lexer = nullptr;
+    /// Tokens - If set, tokens are read from this pre-lexed stream instead
+    /// of being pulled from the lexer one at a time.
+    TokenStream* Tokens = nullptr;
+    size_t TokIdx = 0, NextTokIdx = 0;
+    /// Operators - Binary operator precedences of this session, shared with
+    /// the code generator that installs user defined operators.
+    OperatorTable &Operators;
     ASTVisitor* Visitor = nullptr;
     bool IsJit = false;
+    /// Context - Arena for the expressions of the top-level construct being
+    /// parsed; reset once the visitor is done with it.
+    ASTContext Context;
+    /// Passes - AST transformations run on each definition before Visitor.
+    std::vector<ASTVisitor*> Passes;
 public:
     
-    Parser(Lexer* lexer, ASTVisitor* visitor, bool isJit = false)
-            :lexer(lexer), Visitor(visitor), IsJit(isJit) {}
+    Parser(Lexer* lexer, OperatorTable& operators, ASTVisitor* visitor,
+            bool isJit = false)
+            :lexer(lexer), Operators(operators), Visitor(visitor),
+            IsJit(isJit) {}
+    Parser(TokenStream& tokens, OperatorTable& operators, ASTVisitor* visitor,
+            bool isJit = false);
+
+    /// setHashConsing - Share structurally identical pure subexpressions
+    /// instead of building a fresh node for every occurrence.
+    void setHashConsing(bool Enable) { Context.setUniquing(Enable); }
+
+    /// addPass - Run Pass over every parsed definition before it reaches the
+    /// visitor.  Passes allocate new nodes in getContext().
+    void addPass(ASTVisitor* Pass) { Passes.push_back(Pass); }
+    ASTContext& getContext() { return Context; }
 
-    int CurTok;
+    int CurTok = 0;
     int getNextToken();
 
-    /// BinopPrecedence - This holds the precedence for each binary operator that is
-    /// defined.
-    static std::map<char, int> BinopPrecedence;
-    static std::map<char, int> InitBinopPrecedence();
+    /// Payload and location of the current token.
+    double getNumVal();
+    Symbol getIdentifier();
+    llvm::SMLoc getLocation();
 
     /// GetTokPrecedence - Get the precedence of the pending binary operator token.
     int GetTokPrecedence();
 
     /// LogError* - These are little helper functions for error handling.
-    std::unique_ptr<ExprAST> LogError(const char *Str);
+    ExprAST *LogError(const char *Str);
     std::unique_ptr<PrototypeAST> LogErrorP(const char *Str);
     
-    std::unique_ptr<ExprAST> ParseNumberExpr();
-    std::unique_ptr<ExprAST> ParseParenExpr();
-    std::unique_ptr<ExprAST> ParseIdentifierExpr();
-    std::unique_ptr<ExprAST> ParseIfExpr();
-    std::unique_ptr<ExprAST> ParseForExpr();
-    std::unique_ptr<ExprAST> ParseVarExpr();
-    std::unique_ptr<ExprAST> ParsePrimary();
-    std::unique_ptr<ExprAST> ParseUnary();
-    std::unique_ptr<ExprAST> ParseBinOpRHS(int, std::unique_ptr<ExprAST>);
-    std::unique_ptr<ExprAST> ParseExpression();
+    ExprAST *ParseNumberExpr();
+    ExprAST *ParseParenExpr();
+    ExprAST *ParseIdentifierExpr();
+    ExprAST *ParseIfExpr();
+    ExprAST *ParseForExpr();
+    ExprAST *ParseVarExpr();
+    ExprAST *ParsePrimary();
+    ExprAST *ParseUnary();
+    ExprAST *CreateOperatorCall(const char *Kind, int Op,
+                                llvm::ArrayRef<ExprAST *> Args,
+                                llvm::SMLoc Loc);
+    ExprAST *ParseBinOpRHS(int, ExprAST *);
+    ExprAST *ParseExpression();
     std::unique_ptr<PrototypeAST> ParsePrototype();
     std::unique_ptr<FunctionAST> ParseDefinition();
     std::unique_ptr<FunctionAST> ParseTopLevelExpr();
@@ -0,0 +1,53 @@
+#ifndef __PURITY_H__
+#define __PURITY_H__
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+
+#include "AST.h"
+
+/// PurityAnalysis - Finds the functions whose calls have no effect besides
+/// their result, so that LLVM may merge, hoist or drop them.
+///
+/// Kaleidoscope code can only have side effects through externs such as
+/// putchard: variables are local and every value is a double.  A
+/// definition is pure if it only calls pure functions, itself included,
+/// and it will return if, in addition, it is not recursive and all of its
+/// loops are counted loops, which always terminate.
+///
+/// Definitions are analyzed in order, bottom-up over the call graph: every
+/// callee is defined before its caller except for the caller itself, or
+/// for a function only declared by 'extern' so far.  Such a function counts
+/// as impure, so recursion through a forward declaration is conservatively
+/// treated as a side effect.
+class PurityAnalysis {
+public:
+  struct Effects {
+    /// Pure - The function reads and writes no memory the caller can see
+    /// and does not unwind.
+    bool Pure = false;
+    /// WillReturn - The function returns for every argument.
+    bool WillReturn = false;
+  };
+
+private:
+  llvm::StringMap<Effects> Summaries;
+
+public:
+  /// analyze - Compute the effects of the definition Proto with body Body
+  /// from those of its callees and remember them.
+  Effects analyze(const PrototypeAST &Proto, ExprAST *Body);
+
+  /// forget - Drop what analyze found for the function Name, whose
+  /// definition was rejected, so that its callers get no guarantees.
+  void forget(llvm::StringRef Name) { Summaries.erase(Name); }
+
+  /// getEffects - The effects of the function Name, or none of the
+  /// guarantees if it has not been defined yet.
+  Effects getEffects(llvm::StringRef Name) const {
+    auto I = Summaries.find(Name);
+    return I == Summaries.end() ? Effects() : I->second;
+  }
+};
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef __SCAN_H__
+#define __SCAN_H__
+
+namespace scan {
+
+/// Scanner - Byte scanning primitives used by the file lexer to step over
+/// runs of insignificant characters.  Every routine looks at [Ptr, End) and
+/// returns End if it runs off the range.
+struct Scanner {
+  const char *Name;
+
+  /// skipWhitespace - Return the first byte that is not ' ', '\t', '\f',
+  /// '\v', '\r' or '\n'.
+  const char *(*skipWhitespace)(const char *Ptr, const char *End);
+
+  /// skipToLineEnd - Return the first '\n', '\r' or '\0'.
+  const char *(*skipToLineEnd)(const char *Ptr, const char *End);
+};
+
+enum class Impl { Scalar, SSE2, AVX2 };
+
+/// getScanner - Return the scanner for Kind, or null if it is not compiled
+/// in or not supported by the host CPU.
+const Scanner *getScanner(Impl Kind);
+
+/// getHostScanner - The fastest scanner supported by the host CPU.
+const Scanner &getHostScanner();
+
+} // namespace scan
+
+#endif
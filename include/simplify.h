@@ -0,0 +1,105 @@
+#ifndef __SIMPLIFY_H__
+#define __SIMPLIFY_H__
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/SmallPtrSet.h"
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/Support/SourceMgr.h"
+
+#include "AST.h"
+#include "symbol.h"
+
+/// ASTSimplifier - Rewrites a function body before code generation:
+///   - folds builtin arithmetic, comparisons and logic on literals, and
+///     '&&' or '||' whose left operand is a literal that decides it,
+///   - applies the IEEE-exact identities x*1, 1*x, x/1, x-0 and x+(-0),
+///   - drops the dead arm of an if whose condition is a literal,
+///   - inlines calls to small, non-recursive functions and user defined
+///     operators such as 'binary :'.
+///
+/// New nodes are built in the parser's ASTContext, so a hash-consed tree
+/// stays hash-consed.  Nodes are never modified in place because they may
+/// be shared.
+class ASTSimplifier : public ASTVisitor {
+    ASTContext &Context;
+    SymbolTable &Symbols;
+
+    /// Result - The simplified form of the expression last visited.
+    ExprAST *Result = nullptr;
+
+    /// InlineOp - The body of a function or operator small enough to be
+    /// inlined.  The body is kept in OpContext because the parser's arena
+    /// only lives as long as one definition.
+    struct InlineOp {
+        Symbol Name;
+        llvm::SmallVector<Symbol, 2> Params;
+        llvm::SmallVector<unsigned, 2> Uses; // Reads of each parameter.
+        ExprAST *Body = nullptr;
+    };
+    ASTContext OpContext;
+    InlineOp UnaryOps[256], BinaryOps[256];
+    llvm::DenseMap<Symbol, InlineOp> Functions;
+    llvm::SmallPtrSet<const InlineOp *, 4> Inlining;
+    /// Recorded - The entry the last definition filled in, until the
+    /// next one; dropped if code generation rejects the definition.
+    InlineOp *Recorded = nullptr;
+
+    /// CurFunction - Name of the definition being simplified, for remarks.
+    Symbol CurFunction;
+    bool Remarks = false;
+    llvm::SourceMgr *SrcMgr = nullptr;
+    void remark(llvm::SMLoc Loc, const llvm::Twine &Msg);
+
+    /// FreshNames - Names for the variables that hold inlined operands.  They
+    /// contain a '.', so they cannot clash with user identifiers.
+    std::vector<Symbol> FreshNames;
+    unsigned NextFresh = 0;
+    Symbol getFreshName();
+
+    ExprAST *simplify(ExprAST *E);
+    /// build* - Make the simplest expression equivalent to the given node.
+    /// Orig, if set, is returned when it already is that expression.
+    ExprAST *buildUnary(char Op, ExprAST *Operand, llvm::SMLoc Loc,
+                        UnaryExprAST *Orig = nullptr);
+    ExprAST *buildBinary(char Op, ExprAST *LHS, ExprAST *RHS, llvm::SMLoc Loc,
+                         BinaryExprAST *Orig = nullptr);
+    ExprAST *buildIf(ExprAST *Cond, ExprAST *Then, ExprAST *Else,
+                     llvm::SMLoc Loc, IfExprAST *Orig = nullptr);
+    ExprAST *buildCall(Symbol Callee, llvm::ArrayRef<ExprAST *> Args,
+                       llvm::SMLoc Loc, CallExprAST *Orig = nullptr);
+    ExprAST *inlineOp(const InlineOp &Op, llvm::ArrayRef<ExprAST *> Args,
+                      llvm::SMLoc Loc);
+    ExprAST *substitute(ExprAST *E, llvm::ArrayRef<Symbol> Params,
+                        llvm::ArrayRef<ExprAST *> Args);
+    void recordDefinition(PrototypeAST &Proto, ExprAST *Body);
+
+public:
+    /// InlineThreshold - Largest body, in nodes, that is inlined.
+    static const unsigned InlineThreshold = 16;
+
+    ASTSimplifier(ASTContext &Context, SymbolTable &Symbols)
+            : Context(Context), Symbols(Symbols) {}
+
+    /// enableRemarks - Report every inlined call.  Locations are printed
+    /// through SrcMgr when one is given.
+    void enableRemarks(llvm::SourceMgr *SM) {
+        Remarks = true;
+        SrcMgr = SM;
+    }
+
+    Value* visit(NumberExprAST&) override;
+    Value* visit(VariableExprAST&) override;
+    Value* visit(UnaryExprAST&) override;
+    Value* visit(BinaryExprAST&) override;
+    Value* visit(CallExprAST&) override;
+    Value* visit(IfExprAST&) override;
+    Value* visit(ForExprAST&) override;
+    Value* visit(VarExprAST&) override;
+    Function* visit(PrototypeAST&) override { return nullptr; }
+    Function* visit(FunctionAST&) override;
+    void definitionRejected() override;
+};
+
+#endif
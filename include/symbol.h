@@ -0,0 +1,61 @@
+#ifndef __SYMBOL_H__
+#define __SYMBOL_H__
+
+#include "llvm/ADT/DenseMapInfo.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/StringSaver.h"
+
+/// Symbol - A handle to an interned identifier.  Two symbols compare equal iff
+/// they name the same string, so comparisons and hashing are pointer cheap.
+/// The text is owned by the SymbolTable that produced the handle.
+class Symbol {
+  const char *Data = nullptr;
+  unsigned Length = 0;
+
+  Symbol(llvm::StringRef S) : Data(S.data()), Length(S.size()) {}
+  friend class SymbolTable;
+  friend struct llvm::DenseMapInfo<Symbol>;
+
+public:
+  Symbol() = default;
+
+  llvm::StringRef str() const { return llvm::StringRef(Data, Length); }
+  /// The interned text is always null terminated.
+  const char *c_str() const { return Data; }
+  bool empty() const { return Length == 0; }
+  explicit operator bool() const { return Data != nullptr; }
+
+  bool operator==(Symbol RHS) const { return Data == RHS.Data; }
+  bool operator!=(Symbol RHS) const { return Data != RHS.Data; }
+};
+
+/// SymbolTable - Owns the storage of every interned identifier.
+class SymbolTable {
+  llvm::BumpPtrAllocator Alloc;
+  llvm::UniqueStringSaver Saver;
+
+public:
+  SymbolTable() : Saver(Alloc) {}
+  SymbolTable(const SymbolTable &) = delete;
+  SymbolTable &operator=(const SymbolTable &) = delete;
+
+  Symbol intern(llvm::StringRef S) { return Symbol(Saver.save(S)); }
+};
+
+namespace llvm {
+template <> struct DenseMapInfo<Symbol> {
+  static Symbol getEmptyKey() {
+    return Symbol(StringRef(DenseMapInfo<const char *>::getEmptyKey(), 0));
+  }
+  static Symbol getTombstoneKey() {
+    return Symbol(StringRef(DenseMapInfo<const char *>::getTombstoneKey(), 0));
+  }
+  static unsigned getHashValue(Symbol S) {
+    return DenseMapInfo<const char *>::getHashValue(S.Data);
+  }
+  static bool isEqual(Symbol LHS, Symbol RHS) { return LHS == RHS; }
+};
+} // namespace llvm
+
+#endif
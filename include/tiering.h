@@ -0,0 +1,71 @@
+#ifndef __TIERING_H__
+#define __TIERING_H__
+
+#include "KaleidoscopeJIT.h"
+#include "optimizer.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// TieredCompiler - Gives each definition of the JIT two tiers: it first
+/// runs unoptimized, and once it is hot it is recompiled at -O3 on a
+/// background thread.
+///
+/// Every function is called through an indirection stub named after it,
+/// self calls of tier 0 code included, so switching tiers is one pointer
+/// update that every later call sees.  Calls already running stay in the
+/// code they started in.
+///
+/// Tier 0 code is compiled with optnone and counts its entries and loop
+/// iterations in a private counter.  When the counter reaches Threshold it
+/// calls back into the compiler, which queues the function for the worker.
+/// The counters are invisible to Kaleidoscope code, so callers may keep
+/// treating a pure function as pure.
+class TieredCompiler {
+  /// TieredFunction - A definition and, until the worker takes it, the
+  /// unoptimized copy of its module to build tier 1 from.
+  struct TieredFunction {
+    TieredCompiler *Owner;
+    std::string Name;
+    llvm::orc::ThreadSafeModule Hot;
+  };
+
+  llvm::orc::KaleidoscopeJIT &JIT;
+  std::unique_ptr<llvm::orc::IndirectStubsManager> Stubs;
+  uint64_t Threshold;
+  /// Functions - Owns every TieredFunction; tier 0 code points to them.
+  /// Only the thread adding definitions touches it.
+  std::vector<std::unique_ptr<TieredFunction>> Functions;
+
+  /// HotOptimizer - The -O3 pipeline for tier 1, only run by the worker.
+  Optimizer HotOptimizer;
+
+  std::mutex QueueMutex;
+  std::condition_variable QueueChanged;
+  std::deque<TieredFunction *> Queue;
+  bool Stopping = false;
+  std::thread Worker;
+
+  /// tierUp - Called by tier 0 code that just got hot.
+  static void tierUp(TieredFunction *TF);
+  void runWorker();
+  void recompile(TieredFunction &TF);
+  void instrument(llvm::Function &F, TieredFunction &TF);
+
+public:
+  TieredCompiler(llvm::orc::KaleidoscopeJIT &JIT, uint64_t Threshold);
+  ~TieredCompiler();
+
+  /// addDefinition - Add the module TSM, which defines the function Name,
+  /// to the JIT at tier 0 and make Name callable.
+  llvm::Error addDefinition(llvm::orc::ThreadSafeModule TSM,
+                            llvm::StringRef Name);
+};
+
+#endif
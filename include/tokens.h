@@ -0,0 +1,44 @@
+#ifndef __TOKENS_H__
+#define __TOKENS_H__
+
+#include <cstdint>
+#include <vector>
+#include "llvm/Support/SMLoc.h"
+#include "symbol.h"
+
+class LexerFile;
+
+/// TokenStream - Every token of a buffer, lexed up front and stored as
+/// parallel arrays: the token kind, the byte offset of its first character
+/// and, for numbers and identifiers, an index into the matching payload
+/// array.  The last token is always tok_eof.
+class TokenStream {
+  LexerFile &Lex;
+  const char *BufStart = nullptr;
+
+  std::vector<int16_t> Kinds;
+  std::vector<uint32_t> Offsets;
+  std::vector<uint32_t> Payloads;
+
+  std::vector<double> Numbers;
+  std::vector<Symbol> Identifiers;
+
+public:
+  explicit TokenStream(LexerFile &Lex) : Lex(Lex) {}
+
+  /// lex - Run the lexer over its whole buffer.
+  void lex();
+
+  size_t size() const { return Kinds.size(); }
+  int getKind(size_t I) const { return Kinds[I]; }
+  llvm::SMLoc getLocation(size_t I) const {
+    return llvm::SMLoc::getFromPointer(BufStart + Offsets[I]);
+  }
+  /// Payload accessors, only valid for tok_number and tok_identifier.
+  double getNumVal(size_t I) const { return Numbers[Payloads[I]]; }
+  Symbol getIdentifier(size_t I) const { return Identifiers[Payloads[I]]; }
+
+  LexerFile &getLexer() { return Lex; }
+};
+
+#endif
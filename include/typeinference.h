@@ -0,0 +1,100 @@
+#ifndef __TYPEINFERENCE_H__
+#define __TYPEINFERENCE_H__
+
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/ScopedHashTable.h"
+
+#include <cstdint>
+
+#include "AST.h"
+#include "symbol.h"
+
+/// isAssigned - Whether E contains an assignment to a variable called Name,
+/// in any scope.
+bool isAssigned(ExprAST *E, Symbol Name);
+
+/// matchCountedLoop - Whether Node has the form
+///   for i = <integer>, i < <invariant>, <positive integer> in body
+/// with a body that never assigns to i.  If so, set Start, Step and Bound,
+/// the right hand side of the end condition.  Such a loop runs the body
+/// for i = Start, Start+Step, ... and may use an integer counter.
+bool matchCountedLoop(ForExprAST &Node, int64_t &Start, int64_t &Step,
+                      ExprAST *&Bound);
+
+/// TypeInference - Finds the expressions of a function body that provably
+/// evaluate to booleans (0 or 1), such as comparisons, '!', '&&' and '||',
+/// or to integers small enough that double and 64-bit integer arithmetic
+/// agree on them (magnitude at most 2^53), so that code generation can emit
+/// them as i1 and i64.
+///
+/// Every expression is a double as far as the language is concerned, so
+/// each type is a promise about the value, not a different semantics:
+/// converting a Bool or Int result to double gives exactly the value the
+/// all-double code would have computed.  Variables are typed by binding.
+/// Only bindings that are never assigned, the induction variable of a
+/// counted loop and the initialized var/in names, can be narrower than
+/// Double; parameters are always Double.
+///
+/// A node shared by a hash-consed AST gets the join of the types it has in
+/// each of its contexts.
+class TypeInference : public ASTVisitor {
+public:
+  enum TypeKind { TK_Bool, TK_Int, TK_Double };
+
+  /// TypeInfo - The type of an expression and, for TK_Int, the range of
+  /// its value.  TK_Bool implies the range [0, 1].
+  struct TypeInfo {
+    TypeKind Kind = TK_Double;
+    double Lo = 0, Hi = 0;
+
+    static TypeInfo getBool() { return {TK_Bool, 0, 1}; }
+    static TypeInfo getInt(double Lo, double Hi);
+    static TypeInfo getDouble() { return {}; }
+    bool isIntegral() const { return Kind != TK_Double; }
+    bool operator==(const TypeInfo &RHS) const {
+      return Kind == RHS.Kind && Lo == RHS.Lo && Hi == RHS.Hi;
+    }
+    bool operator!=(const TypeInfo &RHS) const { return !(*this == RHS); }
+  };
+
+  /// MaxExact - Largest magnitude up to which every integer is a double.
+  static constexpr double MaxExact = 9007199254740992.0; // 2^53
+
+private:
+  llvm::DenseMap<ExprAST *, TypeInfo> Types;
+  /// Bindings - Types of the variables introduced by a for loop (keyed by
+  /// the ForExprAST) or by a var/in (keyed by the entry in VarNames).
+  llvm::DenseMap<const void *, TypeInfo> Bindings;
+  llvm::ScopedHashTable<Symbol, TypeInfo> Scope;
+  using BindingScope = llvm::ScopedHashTableScope<Symbol, TypeInfo>;
+
+  TypeInfo Result;
+  bool Changed = false;
+
+  TypeInfo infer(ExprAST *E);
+  void setResult(ExprAST &E, TypeInfo T);
+  void bind(const void *Key, Symbol Name, TypeInfo T);
+
+public:
+  /// run - Infer the types of Body, whose parameters are doubles.  Results
+  /// of a previous run are discarded.
+  void run(ExprAST *Body);
+
+  /// getType - The type E was inferred to have.  Expressions run() did not
+  /// reach are doubles.
+  TypeKind getType(ExprAST *E) const;
+  TypeKind getBindingType(const void *Key) const;
+
+  Value* visit(NumberExprAST&) override;
+  Value* visit(VariableExprAST&) override;
+  Value* visit(UnaryExprAST&) override;
+  Value* visit(BinaryExprAST&) override;
+  Value* visit(CallExprAST&) override;
+  Value* visit(IfExprAST&) override;
+  Value* visit(ForExprAST&) override;
+  Value* visit(VarExprAST&) override;
+  Function* visit(PrototypeAST&) override { return nullptr; }
+  Function* visit(FunctionAST&) override;
+};
+
+#endif
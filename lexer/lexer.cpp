@@ -1,10 +1,26 @@
 #include "../include/lexer.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/raw_ostream.h"
+#include <algorithm>
+#include <cstring>
 using namespace Token;
 
-LexerFile::LexerFile(llvm::SourceMgr& SrcMgr) : SrcMgr(SrcMgr) {
+LexerFile::LexerFile(llvm::SourceMgr& SrcMgr)
+    : SrcMgr(SrcMgr) {
     CurBuffer = SrcMgr.getMainFileID();
     CurBuf = SrcMgr.getMemoryBuffer(CurBuffer)->getBuffer();
-    CurPtr = CurBuf.begin();
+    CurPtr = TokStart = CurBuf.begin();
+}
+
+void Lexer::printError(llvm::SMLoc Loc, const llvm::Twine &Msg) {
+  llvm::errs() << "Error: " << Msg << "\n";
+}
+
+void LexerFile::printError(llvm::SMLoc Loc, const llvm::Twine &Msg) {
+  if (Loc.isValid())
+    SrcMgr.PrintMessage(Loc, llvm::SourceMgr::DiagKind::DK_Error, Msg);
+  else
+    Lexer::printError(Loc, Msg);
 }
 
 namespace charinfo {
@@ -46,138 +62,229 @@ LLVM_READNONE inline bool isIdentifierBody(char Ch) {
 }
 } // namespace charinfo
 
-int LexerFile::gettok() {
-   
-  //static int LastChar = ' ';
+namespace {
+/// Keyword spellings and their tokens.  The classifier below hashes an
+/// identifier into a 16 entry table using its length and first two
+/// characters; the table is built and checked for collisions at compile time.
+struct KeywordInfo {
+  const char *Spelling;
+  unsigned Length;
+  int Tok;
+};
 
-  // Skip any whitespace.
-  while (*CurPtr && charinfo::isWhitespace(*CurPtr))
-    CurPtr ++;
-  
+constexpr KeywordInfo Keywords[] = {
+    {"def", 3, tok_def},     {"extern", 6, tok_extern}, {"if", 2, tok_if},
+    {"then", 4, tok_then},   {"else", 4, tok_else},     {"for", 3, tok_for},
+    {"in", 2, tok_in},       {"binary", 6, tok_binary}, {"unary", 5, tok_unary},
+    {"var", 3, tok_var},
+};
 
-  if (charinfo::isIdentifierHead(*CurPtr)) { // identifier: [a-zA-Z][a-zA-Z0-9]*
-    IdentifierStr = *CurPtr;
-    CurPtr++;
-    while (charinfo::isIdentifierBody(*CurPtr)){
-      IdentifierStr += *CurPtr;
-      CurPtr++;
+constexpr unsigned KeywordTableSize = 16;
+constexpr unsigned MinKeywordLength = 2;
+constexpr unsigned MaxKeywordLength = 6;
+
+constexpr unsigned hashKeyword(unsigned Length, char C0, char C1) {
+  return (Length * 7 + static_cast<unsigned char>(C0) +
+          static_cast<unsigned char>(C1) * 7) % KeywordTableSize;
+}
+
+struct KeywordTable {
+  // Index into Keywords plus one; zero marks an empty slot.
+  unsigned char Slot[KeywordTableSize] = {};
+  bool Collision = false;
+
+  constexpr KeywordTable() {
+    for (unsigned I = 0; I != sizeof(Keywords) / sizeof(Keywords[0]); ++I) {
+      const KeywordInfo &K = Keywords[I];
+      unsigned H = hashKeyword(K.Length, K.Spelling[0], K.Spelling[1]);
+      if (Slot[H])
+        Collision = true;
+      Slot[H] = I + 1;
     }
+  }
+};
 
-    if (IdentifierStr == "def")
-      return tok_def;
-    if (IdentifierStr == "extern")
-      return tok_extern;
-    if (IdentifierStr == "if")
-      return tok_if;
-    if (IdentifierStr == "then")
-      return tok_then;
-    if (IdentifierStr == "else")
-      return tok_else;
-    if (IdentifierStr == "for")
-      return tok_for;
-    if (IdentifierStr == "in")
-      return tok_in;
-    if (IdentifierStr == "binary")
-      return tok_binary;
-    if (IdentifierStr == "unary")
-      return tok_unary;
-    if (IdentifierStr == "var")
-      return tok_var;
+constexpr KeywordTable KeywordHash;
+static_assert(!KeywordHash.Collision, "keyword hash is not perfect");
+} // namespace
+
+int Token::getKeyword(llvm::StringRef Spelling) {
+  unsigned Length = Spelling.size();
+  if (Length < MinKeywordLength || Length > MaxKeywordLength)
     return tok_identifier;
-  }
 
-  if (charinfo::isDigit(*CurPtr) || *CurPtr == '.') { // Number: [0-9.]+
-    std::string NumStr;
-    do {
-      NumStr += *CurPtr++;
-    } while (charinfo::isDigit(*CurPtr) || *CurPtr == '.');
+  unsigned Slot = KeywordHash.Slot[hashKeyword(Length, Spelling[0], Spelling[1])];
+  if (!Slot)
+    return tok_identifier;
 
-    NumVal = strtod(NumStr.c_str(), nullptr);
-    return tok_number;
+  const KeywordInfo &K = Keywords[Slot - 1];
+  if (K.Length != Length || std::memcmp(K.Spelling, Spelling.data(), Length))
+    return tok_identifier;
+  return K.Tok;
+}
+
+int Lexer::lexToken(const char *&CurPtr) {
+  if (charinfo::isIdentifierHead(*CurPtr)) { // identifier: [a-zA-Z][a-zA-Z0-9]*
+    const char *TokStart = CurPtr++;
+    while (charinfo::isIdentifierBody(*CurPtr))
+      CurPtr++;
+
+    llvm::StringRef Spelling(TokStart, CurPtr - TokStart);
+    int Tok = getKeyword(Spelling);
+    if (Tok == tok_identifier)
+      IdentifierSym = Symbols.intern(Spelling);
+    return Tok;
   }
 
-  if (*CurPtr == '#') {
-    // Comment until end of line.
+  if (charinfo::isDigit(*CurPtr) || *CurPtr == '.') { // Number: [0-9.]+
+    const char *TokStart = CurPtr;
     do
-      CurPtr ++;
-    while (*CurPtr != EOF && *CurPtr != '\n' && *CurPtr != '\r');
+      CurPtr++;
+    while (charinfo::isDigit(*CurPtr) || *CurPtr == '.');
 
-    if (*CurPtr != EOF)
-      return gettok();
+    if (!parseNumber(llvm::StringRef(TokStart, CurPtr - TokStart), NumVal)) {
+      printError(llvm::SMLoc::getFromPointer(TokStart),
+                 "invalid numeric literal");
+      return tok_error;
+    }
+    return tok_number;
   }
 
   // Check for end of file.  Don't eat the EOF.
   if (!*CurPtr)
     return tok_eof;
 
-  // Otherwise, just return the character as its ascii value.
-  int ThisChar = *CurPtr++;
+  // Two character operators.  The buffer always ends in a '\0', so the
+  // second character can be read unconditionally.
+  char Next = CurPtr[1];
+  int TwoCharTok = 0;
+  switch (*CurPtr) {
+  case '<': TwoCharTok = Next == '=' ? tok_le : 0; break;
+  case '>': TwoCharTok = Next == '=' ? tok_ge : 0; break;
+  case '=': TwoCharTok = Next == '=' ? tok_eq : 0; break;
+  case '!': TwoCharTok = Next == '=' ? tok_ne : 0; break;
+  case '&': TwoCharTok = Next == '&' ? tok_and : 0; break;
+  case '|': TwoCharTok = Next == '|' ? tok_or : 0; break;
+  }
+  if (TwoCharTok) {
+    CurPtr += 2;
+    return TwoCharTok;
+  }
+
+  // Otherwise, just return the character as its ascii value.  Bytes outside
+  // of ASCII must not turn into negative values that alias the tokens.
+  int ThisChar = static_cast<unsigned char>(*CurPtr++);
   return ThisChar;
 }
 
-int LexerSimple::gettok() {
-  static int LastChar = ' ';
-
-  // Skip any whitespace.
-  while (isspace(LastChar))
-    LastChar = getchar();
-
-  if (isalpha(LastChar)) { // identifier: [a-zA-Z][a-zA-Z0-9]*
-    IdentifierStr = LastChar;
-    while (isalnum((LastChar = getchar())))
-      IdentifierStr += LastChar;
-
-    if (IdentifierStr == "def")
-      return tok_def;
-    if (IdentifierStr == "extern")
-      return tok_extern;
-    if (IdentifierStr == "if")
-      return tok_if;
-    if (IdentifierStr == "then")
-      return tok_then;
-    if (IdentifierStr == "else")
-      return tok_else;
-    if (IdentifierStr == "for")
-      return tok_for;
-    if (IdentifierStr == "in")
-      return tok_in;
-    if (IdentifierStr == "binary")
-      return tok_binary;
-    if (IdentifierStr == "unary")
-      return tok_unary;
-    if (IdentifierStr == "var")
-      return tok_var;
-    return tok_identifier;
+int LexerFile::gettok() {
+  // Skip any whitespace and comments.
+  while (true) {
+    CurPtr = Scan->skipWhitespace(CurPtr, CurBuf.end());
+    if (*CurPtr != '#')
+      break;
+    // Comment until end of line.
+    CurPtr = Scan->skipToLineEnd(CurPtr + 1, CurBuf.end());
   }
 
-  if (isdigit(LastChar) || LastChar == '.') { // Number: [0-9.]+
-    std::string NumStr;
-    do {
-      NumStr += LastChar;
-      LastChar = getchar();
-    } while (isdigit(LastChar) || LastChar == '.');
+  TokStart = CurPtr;
+  return lexToken(CurPtr);
+}
+
+/// ChunkSize - Minimum number of bytes requested from the stream per read.
+static const size_t ChunkSize = 64 * 1024;
 
-    NumVal = strtod(NumStr.c_str(), nullptr);
-    return tok_number;
+LexerSimple::LexerSimple(int FD, llvm::StringRef BufferName)
+    : FD(FD), BufferName(BufferName.str()) {
+  Buffer.resize(ChunkSize + 1);
+  Buffer[0] = '\0';
+  CurPtr = Avail = BufEnd = Buffer.data();
+}
+
+/// refill - Read the next chunk of the stream.  Text before the line being
+/// lexed is discarded first so the window does not grow with the input.
+/// Returns false once the stream is exhausted.
+bool LexerSimple::refill() {
+  if (AtEOF)
+    return false;
+
+  char *Start = Buffer.data();
+  const char *LineStart = CurPtr;
+  while (LineStart != Start && LineStart[-1] != '\n')
+    --LineStart;
+  BaseLine += std::count(static_cast<const char *>(Start), LineStart, '\n');
+
+  size_t Kept = BufEnd - LineStart;
+  size_t CurOffset = CurPtr - LineStart, AvailOffset = Avail - LineStart;
+  std::memmove(Start, LineStart, Kept);
+  if (Buffer.size() - Kept - 1 < ChunkSize) {
+    Buffer.resize(Kept + ChunkSize + 1);
+    Start = Buffer.data();
   }
 
-  if (LastChar == '#') {
-    // Comment until end of line.
-    do
-      LastChar = getchar();
-    while (LastChar != EOF && LastChar != '\n' && LastChar != '\r');
+  auto ReadOrErr = llvm::sys::fs::readNativeFile(
+      llvm::sys::fs::convertFDToNativeFile(FD),
+      llvm::MutableArrayRef<char>(Start + Kept, Buffer.size() - Kept - 1));
+  size_t Read = 0;
+  if (ReadOrErr) {
+    Read = *ReadOrErr;
+  } else {
+    Lexer::printError(llvm::SMLoc(), "reading " + BufferName + ": " +
+                                         toString(ReadOrErr.takeError()));
+  }
 
-    if (LastChar != EOF)
-      return gettok();
+  CurPtr = Start + CurOffset;
+  BufEnd = Start + Kept + Read;
+  *const_cast<char *>(BufEnd) = '\0';
+  if (Read == 0) {
+    AtEOF = true;
+    Avail = BufEnd;
+    return true;
   }
 
-  // Check for end of file.  Don't eat the EOF.
-  if (LastChar == EOF)
-    return tok_eof;
+  // Only hand out whole lines; the rest waits for the next refill.
+  Avail = BufEnd;
+  while (Avail != Start + AvailOffset && Avail[-1] != '\n')
+    --Avail;
+  return true;
+}
 
-  // Otherwise, just return the character as its ascii value.
-  int ThisChar = LastChar;
-  LastChar = getchar();
-  return ThisChar;
+int LexerSimple::gettok() {
+  // Skip any whitespace and comments, reading more input whenever the
+  // buffered lines run out.
+  while (true) {
+    CurPtr = Scan->skipWhitespace(CurPtr, Avail);
+    if (CurPtr == Avail) {
+      if (AtEOF || !refill())
+        return tok_eof;
+      continue;
+    }
+    if (*CurPtr != '#')
+      break;
+    // Comment until end of line.
+    CurPtr = Scan->skipToLineEnd(CurPtr + 1, Avail);
+  }
+
+  return lexToken(CurPtr);
 }
 
+void LexerSimple::printError(llvm::SMLoc Loc, const llvm::Twine &Msg) {
+  const char *Ptr = Loc.getPointer();
+  const char *Start = Buffer.data();
+  if (!Ptr || Ptr < Start || Ptr > BufEnd)
+    return Lexer::printError(Loc, Msg);
+
+  const char *LineStart = Ptr;
+  while (LineStart != Start && LineStart[-1] != '\n' && LineStart[-1] != '\r')
+    --LineStart;
+  const char *LineEnd = Ptr;
+  while (LineEnd != BufEnd && *LineEnd != '\n' && *LineEnd != '\r')
+    ++LineEnd;
+  unsigned Line = BaseLine + std::count(Start, LineStart, '\n');
+
+  llvm::SMDiagnostic Diag(DiagSrcMgr, Loc, BufferName, Line, Ptr - LineStart,
+                          llvm::SourceMgr::DK_Error, Msg.str(),
+                          llvm::StringRef(LineStart, LineEnd - LineStart),
+                          llvm::None);
+  Diag.print(nullptr, llvm::errs());
+}
@@ -0,0 +1,80 @@
+#include "../include/lexer.h"
+#include "llvm/ADT/APFloat.h"
+#include "llvm/Support/Error.h"
+
+#include <cstdint>
+
+// Exact powers of ten representable in a double.
+static const double PowersOfTen[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+/// slowParse - Correctly rounded conversion for the literals the fast path
+/// cannot handle exactly.  APFloat does not depend on the C locale.
+static double slowParse(llvm::StringRef Digits) {
+  llvm::APFloat F(llvm::APFloat::IEEEdouble());
+  auto StatusOrErr =
+      F.convertFromString(Digits, llvm::APFloat::rmNearestTiesToEven);
+  if (!StatusOrErr) {
+    llvm::consumeError(StatusOrErr.takeError());
+    return 0;
+  }
+  return F.convertToDouble();
+}
+
+bool Token::parseNumber(llvm::StringRef Spelling, double &Result) {
+  const char *Ptr = Spelling.begin(), *End = Spelling.end();
+
+  // Accumulate up to 19 significant digits, which always fit in 64 bits, and
+  // remember the power of ten they have to be scaled by.
+  uint64_t Mantissa = 0;
+  unsigned SigDigits = 0;
+  int Exponent = 0;
+  bool Truncated = false, SeenDot = false, SeenDigit = false;
+
+  for (; Ptr != End; ++Ptr) {
+    if (*Ptr == '.') {
+      if (SeenDot)
+        break;
+      SeenDot = true;
+      continue;
+    }
+
+    SeenDigit = true;
+    unsigned Digit = *Ptr - '0';
+    if (SigDigits == 0 && Digit == 0) {
+      // Leading zeros only shift the exponent.
+      if (SeenDot)
+        --Exponent;
+      continue;
+    }
+    if (SigDigits < 19) {
+      Mantissa = Mantissa * 10 + Digit;
+      ++SigDigits;
+      if (SeenDot)
+        --Exponent;
+    } else {
+      Truncated |= Digit != 0;
+      if (!SeenDot)
+        ++Exponent;
+    }
+  }
+
+  bool Valid = SeenDigit && Ptr == End;
+  llvm::StringRef Digits(Spelling.begin(), Ptr - Spelling.begin());
+  if (!SeenDigit) {
+    Result = 0;
+  } else if (Mantissa == 0) {
+    Result = 0;
+  } else if (!Truncated && Mantissa <= (uint64_t(1) << 53) &&
+             Exponent >= -22 && Exponent <= 22) {
+    // Clinger's fast path: both operands are exact, so the single
+    // multiplication or division rounds correctly.
+    double M = static_cast<double>(Mantissa);
+    Result = Exponent < 0 ? M / PowersOfTen[-Exponent]
+                          : M * PowersOfTen[Exponent];
+  } else {
+    Result = slowParse(Digits);
+  }
+  return Valid;
+}
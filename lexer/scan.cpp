@@ -0,0 +1,146 @@
+#include "../include/scan.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) &&        \
+    defined(__SSE2__)
+#define KALEIDOSCOPE_SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+namespace {
+
+inline bool isWhitespace(char Ch) {
+  return Ch == ' ' || Ch == '\t' || Ch == '\n' || Ch == '\r' || Ch == '\f' ||
+         Ch == '\v';
+}
+
+inline bool isLineEnd(char Ch) {
+  return Ch == '\n' || Ch == '\r' || Ch == '\0';
+}
+
+const char *skipWhitespaceScalar(const char *Ptr, const char *End) {
+  while (Ptr != End && isWhitespace(*Ptr))
+    ++Ptr;
+  return Ptr;
+}
+
+const char *skipToLineEndScalar(const char *Ptr, const char *End) {
+  while (Ptr != End && !isLineEnd(*Ptr))
+    ++Ptr;
+  return Ptr;
+}
+
+#ifdef KALEIDOSCOPE_SCAN_X86
+// The vector routines compare a block against every byte of interest, turn
+// the result into a bit mask and jump straight to the first hit.  The tail
+// shorter than one block is finished by the scalar loop.
+
+const char *skipWhitespaceSSE2(const char *Ptr, const char *End) {
+  const __m128i Space = _mm_set1_epi8(' ');
+  const __m128i Tab = _mm_set1_epi8('\t');
+  const __m128i CR = _mm_set1_epi8('\r');
+  while (End - Ptr >= 16) {
+    __m128i V = _mm_loadu_si128(reinterpret_cast<const __m128i *>(Ptr));
+    // '\t' .. '\r' are contiguous.  The signed compares also put every byte
+    // >= 0x80 outside of that range.
+    __m128i OutOfRange =
+        _mm_or_si128(_mm_cmplt_epi8(V, Tab), _mm_cmpgt_epi8(V, CR));
+    __m128i NotWS = _mm_andnot_si128(_mm_cmpeq_epi8(V, Space), OutOfRange);
+    unsigned Mask = static_cast<unsigned>(_mm_movemask_epi8(NotWS));
+    if (Mask)
+      return Ptr + __builtin_ctz(Mask);
+    Ptr += 16;
+  }
+  return skipWhitespaceScalar(Ptr, End);
+}
+
+const char *skipToLineEndSSE2(const char *Ptr, const char *End) {
+  const __m128i LF = _mm_set1_epi8('\n');
+  const __m128i CR = _mm_set1_epi8('\r');
+  const __m128i Zero = _mm_setzero_si128();
+  while (End - Ptr >= 16) {
+    __m128i V = _mm_loadu_si128(reinterpret_cast<const __m128i *>(Ptr));
+    __m128i Hit = _mm_or_si128(
+        _mm_or_si128(_mm_cmpeq_epi8(V, LF), _mm_cmpeq_epi8(V, CR)),
+        _mm_cmpeq_epi8(V, Zero));
+    unsigned Mask = static_cast<unsigned>(_mm_movemask_epi8(Hit));
+    if (Mask)
+      return Ptr + __builtin_ctz(Mask);
+    Ptr += 16;
+  }
+  return skipToLineEndScalar(Ptr, End);
+}
+
+__attribute__((target("avx2"))) const char *
+skipWhitespaceAVX2(const char *Ptr, const char *End) {
+  const __m256i Space = _mm256_set1_epi8(' ');
+  const __m256i Tab = _mm256_set1_epi8('\t');
+  const __m256i CR = _mm256_set1_epi8('\r');
+  while (End - Ptr >= 32) {
+    __m256i V = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(Ptr));
+    __m256i OutOfRange =
+        _mm256_or_si256(_mm256_cmpgt_epi8(Tab, V), _mm256_cmpgt_epi8(V, CR));
+    __m256i NotWS =
+        _mm256_andnot_si256(_mm256_cmpeq_epi8(V, Space), OutOfRange);
+    unsigned Mask = static_cast<unsigned>(_mm256_movemask_epi8(NotWS));
+    if (Mask)
+      return Ptr + __builtin_ctz(Mask);
+    Ptr += 32;
+  }
+  return skipWhitespaceSSE2(Ptr, End);
+}
+
+__attribute__((target("avx2"))) const char *
+skipToLineEndAVX2(const char *Ptr, const char *End) {
+  const __m256i LF = _mm256_set1_epi8('\n');
+  const __m256i CR = _mm256_set1_epi8('\r');
+  const __m256i Zero = _mm256_setzero_si256();
+  while (End - Ptr >= 32) {
+    __m256i V = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(Ptr));
+    __m256i Hit = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(V, LF), _mm256_cmpeq_epi8(V, CR)),
+        _mm256_cmpeq_epi8(V, Zero));
+    unsigned Mask = static_cast<unsigned>(_mm256_movemask_epi8(Hit));
+    if (Mask)
+      return Ptr + __builtin_ctz(Mask);
+    Ptr += 32;
+  }
+  return skipToLineEndSSE2(Ptr, End);
+}
+#endif
+
+const scan::Scanner ScalarScanner = {"scalar", skipWhitespaceScalar,
+                                     skipToLineEndScalar};
+#ifdef KALEIDOSCOPE_SCAN_X86
+const scan::Scanner SSE2Scanner = {"sse2", skipWhitespaceSSE2,
+                                   skipToLineEndSSE2};
+const scan::Scanner AVX2Scanner = {"avx2", skipWhitespaceAVX2,
+                                   skipToLineEndAVX2};
+#endif
+
+} // namespace
+
+const scan::Scanner *scan::getScanner(Impl Kind) {
+  switch (Kind) {
+  case Impl::Scalar:
+    return &ScalarScanner;
+#ifdef KALEIDOSCOPE_SCAN_X86
+  case Impl::SSE2:
+    return &SSE2Scanner;
+  case Impl::AVX2:
+    return __builtin_cpu_supports("avx2") ? &AVX2Scanner : nullptr;
+#endif
+  default:
+    return nullptr;
+  }
+}
+
+const scan::Scanner &scan::getHostScanner() {
+  static const Scanner *Host = [] {
+    if (const Scanner *S = getScanner(Impl::AVX2))
+      return S;
+    if (const Scanner *S = getScanner(Impl::SSE2))
+      return S;
+    return &ScalarScanner;
+  }();
+  return *Host;
+}
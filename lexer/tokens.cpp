@@ -0,0 +1,33 @@
+#include "../include/tokens.h"
+#include "../include/lexer.h"
+
+using namespace Token;
+
+void TokenStream::lex() {
+  llvm::StringRef Buf = Lex.getBuffer();
+  assert(Buf.size() <= UINT32_MAX && "offsets are 32 bits");
+  BufStart = Buf.begin();
+
+  // Generated sources average a handful of bytes per token; reserving up
+  // front avoids most regrowth of the arrays.
+  size_t Estimate = Buf.size() / 4 + 1;
+  Kinds.reserve(Estimate);
+  Offsets.reserve(Estimate);
+  Payloads.reserve(Estimate);
+
+  int Tok;
+  do {
+    Tok = Lex.gettok();
+    uint32_t Payload = 0;
+    if (Tok == tok_number) {
+      Payload = Numbers.size();
+      Numbers.push_back(Lex.NumVal);
+    } else if (Tok == tok_identifier) {
+      Payload = Identifiers.size();
+      Identifiers.push_back(Lex.getIdentifier());
+    }
+    Kinds.push_back(Tok);
+    Offsets.push_back(Lex.getTokenStart() - BufStart);
+    Payloads.push_back(Payload);
+  } while (Tok != tok_eof);
+}
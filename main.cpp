@@ -1,5 +1,6 @@
 #include "llvm/IR/IRPrintingPasses.h"
 #include "llvm/CodeGen/CommandFlags.h"
+#include "llvm/Config/llvm-config.h"
 #include "llvm/Support/CommandLine.h"
 #include "llvm/Support/InitLLVM.h"
 #include "llvm/Support/TargetRegistry.h"
@@ -9,13 +10,19 @@
 #include "llvm/Target/TargetMachine.h"
 #include "llvm/Target/TargetOptions.h"
 #include "llvm/Support/Host.h"
+#include "llvm/Support/Timer.h"
 #include "llvm/Support/ToolOutputFile.h"
 #include "llvm/Support/WithColor.h"
 //#include "version.inc"
 #include "include/lexer.h"
 #include "include/parser.h"
+#include "include/tokens.h"
 #include "include/codegen.h"
+#include "include/simplify.h"
+#include "include/multiversion.h"
+#include "include/optimizer.h"
 #include "include/JIT.h"
+#include "include/objectcache.h"
 
 #include <memory>
 #include <string>
@@ -76,6 +83,186 @@ static llvm::cl::opt<bool>
              llvm::cl::desc("Emit IR code instead of assembler"),
              llvm::cl::init(false));
 
+static llvm::cl::opt<bool>
+    TimePhases("time-phases",
+               llvm::cl::desc("Time lexing, parsing and emission separately"),
+               llvm::cl::init(false));
+
+static llvm::cl::opt<bool>
+    HashCons("hash-cons",
+             llvm::cl::desc("Share identical pure subexpressions in the AST "
+                            "and emit each of them once per scope"),
+             llvm::cl::init(false));
+
+static llvm::cl::opt<bool>
+    Simplify("simplify",
+             llvm::cl::desc("Fold constants and inline small functions and "
+                            "operators in the AST before code generation"),
+             llvm::cl::init(true));
+
+static llvm::cl::opt<bool>
+    Remarks("remarks",
+            llvm::cl::desc("Report inlined calls and tail calls turned into "
+                           "loops"),
+            llvm::cl::init(false));
+
+static llvm::cl::opt<bool>
+    LazyJIT("lazy",
+            llvm::cl::desc("In the JIT, compile and optimize each function "
+                           "only when it is first called"),
+            llvm::cl::init(false));
+
+static llvm::cl::opt<bool>
+    Tiered("tiered",
+           llvm::cl::desc("In the JIT, run definitions unoptimized and "
+                          "recompile hot ones at -O3 in the background"),
+           llvm::cl::init(false));
+
+static llvm::cl::opt<unsigned long long>
+    TierThreshold("tier-threshold",
+                  llvm::cl::desc("Calls plus loop iterations after which "
+                                 "-tiered recompiles a function"),
+                  llvm::cl::init(10000));
+
+static llvm::cl::opt<std::string>
+    ObjectCacheDir("object-cache-dir",
+                   llvm::cl::desc("In the JIT, keep compiled objects in this "
+                                  "directory and reuse them across runs"),
+                   llvm::cl::value_desc("directory"), llvm::cl::init(""));
+
+static llvm::cl::opt<unsigned>
+    ObjectCacheSize("object-cache-size",
+                    llvm::cl::desc("Megabytes of objects -object-cache-dir "
+                                   "keeps before evicting the least "
+                                   "recently used"),
+                    llvm::cl::init(512));
+
+static llvm::cl::opt<bool>
+    ObjectCacheStats("object-cache-stats",
+                     llvm::cl::desc("Print the object cache's hits, misses "
+                                    "and evictions on exit"),
+                     llvm::cl::init(false));
+
+static llvm::cl::opt<unsigned>
+    BatchSize("batch",
+              llvm::cl::desc("In the JIT, compile up to this many consecutive "
+                             "top level expressions in one module and run "
+                             "them together"),
+              llvm::cl::value_desc("N"), llvm::cl::init(1));
+
+static llvm::cl::opt<bool>
+    PrintIR("print-ir",
+            llvm::cl::desc("In the JIT, print the IR of each function"),
+            llvm::cl::init(false));
+
+static llvm::cl::opt<bool>
+    PrintResults("print-results",
+                 llvm::cl::desc("Print the value of each top level expression "
+                                "even with -batch"),
+                 llvm::cl::init(false));
+
+static llvm::cl::opt<bool>
+    JITMemoryStats("jit-memory-stats",
+                   llvm::cl::desc("Print how much memory the JIT mapped and "
+                                  "reused on exit"),
+                   llvm::cl::init(false));
+
+static llvm::cl::list<std::string>
+    Multiversion("multiversion",
+                 llvm::cl::desc("Compile every exported function for each "
+                                "of these x86-64 levels and the baseline, "
+                                "and pick one at load time"),
+                 llvm::cl::value_desc("level,level,..."),
+                 llvm::cl::CommaSeparated);
+
+static llvm::cl::OptionCategory
+    FPCategory("Floating point options",
+               "These trade IEEE 754 conformance for speed.  By default "
+               "floating point code is strict.");
+
+static llvm::cl::opt<bool>
+    FastMath("ffast-math",
+             llvm::cl::desc("Allow every transform below, and contraction"),
+             llvm::cl::cat(FPCategory), llvm::cl::init(false));
+
+static llvm::cl::opt<bool>
+    AssociativeMath("fassociative-math",
+                    llvm::cl::desc("Allow reassociating floating point "
+                                   "operations"),
+                    llvm::cl::cat(FPCategory), llvm::cl::init(false));
+
+static llvm::cl::opt<bool>
+    ReciprocalMath("freciprocal-math",
+                   llvm::cl::desc("Allow x/y to become x*(1/y)"),
+                   llvm::cl::cat(FPCategory), llvm::cl::init(false));
+
+static llvm::cl::opt<bool>
+    NoSignedZeros("fno-signed-zeros",
+                  llvm::cl::desc("Treat -0.0 and +0.0 as interchangeable"),
+                  llvm::cl::cat(FPCategory), llvm::cl::init(false));
+
+static llvm::cl::opt<bool>
+    NoHonorNaNs("fno-honor-nans",
+                llvm::cl::desc("Assume no operand or result is a NaN"),
+                llvm::cl::cat(FPCategory), llvm::cl::init(false));
+
+static llvm::cl::opt<bool>
+    NoHonorInfinities("fno-honor-infinities",
+                      llvm::cl::desc("Assume no operand or result is "
+                                     "infinite"),
+                      llvm::cl::cat(FPCategory), llvm::cl::init(false));
+
+static llvm::cl::opt<bool>
+    FiniteMathOnly("ffinite-math-only",
+                   llvm::cl::desc("Same as -fno-honor-nans "
+                                  "-fno-honor-infinities"),
+                   llvm::cl::cat(FPCategory), llvm::cl::init(false));
+
+static llvm::cl::opt<bool>
+    ApproxFunc("fapprox-func",
+               llvm::cl::desc("Allow approximating calls to math functions"),
+               llvm::cl::cat(FPCategory), llvm::cl::init(false));
+
+enum FPContractMode { FPC_Off, FPC_Fast };
+
+static llvm::cl::opt<FPContractMode> FPContract(
+    "ffp-contract",
+    llvm::cl::desc("Whether a*b+c may become a fused multiply-add:"),
+    llvm::cl::values(
+        clEnumValN(FPC_Off, "off", "Never (default)"),
+        clEnumValN(FPC_Fast, "fast", "Whenever profitable (default with "
+                                     "-ffast-math)")),
+    llvm::cl::cat(FPCategory), llvm::cl::init(FPC_Off));
+
+/// getFPOptions - The floating point options the flags above select.
+/// Individual flags refine -ffast-math; only -ffp-contract can take back
+/// something it allowed.
+static FPOptions getFPOptions() {
+  FPOptions FP;
+  if (FastMath)
+    FP.setFast();
+  FP.Reassoc |= AssociativeMath;
+  FP.AllowReciprocal |= ReciprocalMath;
+  FP.NoSignedZeros |= NoSignedZeros;
+  FP.NoNaNs |= NoHonorNaNs || FiniteMathOnly;
+  FP.NoInfs |= NoHonorInfinities || FiniteMathOnly;
+  FP.ApproxFunc |= ApproxFunc;
+  if (FPContract.getNumOccurrences())
+    FP.Contract = FPContract == FPC_Fast;
+  return FP;
+}
+
+/// getCodeGenOptLevel - Back end effort for the -O level; -Os and -Oz
+/// behave like -O2.
+static llvm::CodeGenOpt::Level getCodeGenOptLevel() {
+  switch (OptLevel) {
+  case 0: return llvm::CodeGenOpt::None;
+  case 1: return llvm::CodeGenOpt::Less;
+  case 3: return llvm::CodeGenOpt::Aggressive;
+  default: return llvm::CodeGenOpt::Default;
+  }
+}
+
 llvm::TargetMachine *createTargetMachine(const char *Argv0) {
   llvm::Triple Triple = llvm::Triple(
       !MTriple.empty()
@@ -85,6 +272,7 @@ llvm::TargetMachine *createTargetMachine(const char *Argv0) {
   
   llvm::TargetOptions TargetOptions =
       codegen::InitTargetOptionsFromCodeGenFlags(Triple);
+  getFPOptions().apply(TargetOptions);
   std::string CPUStr = codegen::getCPUStr();
   std::string FeatureStr = codegen::getFeaturesStr();
   
@@ -100,10 +288,89 @@ llvm::TargetMachine *createTargetMachine(const char *Argv0) {
     
   llvm::TargetMachine *TM = Target->createTargetMachine(
       Triple.getTriple(), CPUStr, FeatureStr, TargetOptions,
-      llvm::Optional<llvm::Reloc::Model>(codegen::getRelocModel()));
+      llvm::Optional<llvm::Reloc::Model>(codegen::getRelocModel()),
+      codegen::getExplicitCodeModel(), getCodeGenOptLevel());
   return TM;
 }
 
+/// getJITCodeGenOptLevel - Back end effort for the JIT.  Tier 0 code is
+/// optnone, which the back end honors per function.
+static llvm::CodeGenOpt::Level getJITCodeGenOptLevel() {
+  return Tiered ? llvm::CodeGenOpt::Aggressive : getCodeGenOptLevel();
+}
+
+/// getJITTargetMachineBuilder - Describes the code the JIT generates: for
+/// the host CPU and every feature it has, unless -mcpu names another CPU,
+/// whose own features then replace the host's.  -mattr adds or removes
+/// features on top of either.
+static llvm::Expected<llvm::orc::JITTargetMachineBuilder>
+getJITTargetMachineBuilder() {
+  auto JTMB = llvm::orc::JITTargetMachineBuilder::detectHost();
+  if (!JTMB)
+    return JTMB.takeError();
+
+  std::string CPU = codegen::getMCPU();
+  if (!CPU.empty() && CPU != "native") {
+    JTMB->setCPU(CPU);
+    JTMB->getFeatures() = llvm::SubtargetFeatures();
+  }
+  JTMB->addFeatures(codegen::getMAttrs());
+
+  llvm::TargetOptions Options =
+      codegen::InitTargetOptionsFromCodeGenFlags(JTMB->getTargetTriple());
+  getFPOptions().apply(Options);
+  JTMB->setOptions(Options);
+  JTMB->setCodeGenOptLevel(getJITCodeGenOptLevel());
+  return JTMB;
+}
+
+/// printTargetOptions - The fields of Options that codegen flags can set and
+/// that change the code the back end emits.
+static void printTargetOptions(llvm::raw_ostream &OS,
+                               const llvm::TargetOptions &Options) {
+  OS << " fpmath" << Options.UnsafeFPMath << Options.NoInfsFPMath
+     << Options.NoNaNsFPMath << Options.NoTrappingFPMath
+     << Options.NoSignedZerosFPMath
+     << Options.HonorSignDependentRoundingFPMathOption << " denormal ";
+  Options.getRawFPDenormalMode().print(OS);
+  OS << ' ';
+  Options.getRawFP32DenormalMode().print(OS);
+  OS << " abi" << Options.FloatABIType << " fusion" << Options.AllowFPOpFusion
+     << " threads" << Options.ThreadModel << " eh"
+     << (int)Options.ExceptionModel << " tls" << Options.EmulatedTLS << ','
+     << Options.TLSSize << " sections" << Options.FunctionSections
+     << Options.DataSections << Options.UniqueSectionNames
+     << (int)Options.BBSections << " flags" << Options.NoZerosInBSS
+     << Options.GuaranteedTailCallOpt << Options.StackSymbolOrdering
+     << Options.EnableFastISel << Options.EnableGlobalISel
+     << Options.UseInitArray << Options.RelaxELFRelocations
+     << Options.TrapUnreachable << Options.NoTrapAfterNoreturn
+     << Options.EmitStackSizeSection << Options.EmitAddrsig
+     << Options.ForceDwarfFrameSection;
+}
+
+/// getObjectCacheSalt - Everything besides the optimized IR that the JIT's
+/// objects depend on.
+static std::string
+getObjectCacheSalt(const llvm::orc::JITTargetMachineBuilder &JTMB) {
+  FPOptions FP = getFPOptions();
+  std::string Salt;
+  llvm::raw_string_ostream OS(Salt);
+  OS << JTMB.getTargetTriple().str() << ' ' << JTMB.getCPU() << ' '
+     << JTMB.getFeatures().getString() << " O" << getJITCodeGenOptLevel()
+     << " fp" << FP.Reassoc << FP.AllowReciprocal << FP.NoSignedZeros
+     << FP.NoNaNs << FP.NoInfs << FP.ApproxFunc << FP.Contract;
+  printTargetOptions(OS, JTMB.getOptions());
+  OS << " reloc";
+  if (JTMB.getRelocationModel())
+    OS << *JTMB.getRelocationModel();
+  OS << " model";
+  if (JTMB.getCodeModel())
+    OS << *JTMB.getCodeModel();
+  OS << " llvm" LLVM_VERSION_STRING;
+  return OS.str();
+}
+
 int emit(StringRef Argv0, llvm::Module& M, llvm::TargetMachine& TM,
                 StringRef InputFilename){
   CodeGenFileType FileType = codegen::getFileType();
@@ -184,14 +451,37 @@ int main(int argc, char *argv[])
         SrcMgr.AddNewSourceBuffer(std::move(*FileOrErr), llvm::SMLoc());
         
         auto &MyModule = *TheModule;
+
+        TimerGroup Phases("kaleidoscope", "Kaleidoscope compilation phases");
+        Timer LexTimer("lex", "Lexing", Phases);
+        Timer ParseTimer("parse", "Parsing and IR generation", Phases);
+        Timer OptTimer("opt", "IR optimization", Phases);
+        Timer EmitTimer("emit", "Code emission", Phases);
         
-        Lexer* lexer = new LexerFile(SrcMgr);
-        auto cg = new CodeGenVisitor(&SrcMgr,std::move(TheContext), std::move(TheModule),
-                        OptLevel?1:0);
-        auto parser = Parser(lexer, cg, false);
-        parser.parse();
-         
-        delete lexer; 
+        LexerFile* lexer = new LexerFile(SrcMgr);
+        TokenStream Tokens(*lexer);
+        {
+          TimeRegion Region(TimePhases ? &LexTimer : nullptr);
+          Tokens.lex();
+        }
+
+        OperatorTable Operators;
+        auto cg = new CodeGenVisitor(&SrcMgr, Operators, std::move(TheContext),
+                        std::move(TheModule), OptLevel);
+        cg->setRemarks(Remarks);
+        cg->setExprSharing(HashCons);
+        cg->setFPOptions(getFPOptions());
+        {
+          TimeRegion Region(TimePhases ? &ParseTimer : nullptr);
+          auto parser = Parser(Tokens, Operators, cg, false);
+          parser.setHashConsing(HashCons);
+          ASTSimplifier Simplifier(parser.getContext(), lexer->getSymbols());
+          if (Remarks)
+            Simplifier.enableRemarks(&SrcMgr);
+          if (Simplify)
+            parser.addPass(&Simplifier);
+          parser.parse();
+        }
 
         InitializeAllTargetInfos();
         InitializeAllTargets();
@@ -202,16 +492,40 @@ int main(int argc, char *argv[])
         auto TheTargetMachine = createTargetMachine(argv[0]); 
         if(!TheTargetMachine){
             delete cg;
+            delete lexer;
             return 1;
         }
         
         MyModule.setDataLayout(TheTargetMachine->createDataLayout());
+        MyModule.setTargetTriple(TheTargetMachine->getTargetTriple().str());
+
+        // Versions are made before optimization so that each is optimized
+        // with the cost model of its own level.
+        if (auto Err = multiversion(MyModule, Multiversion)) {
+          llvm::WithColor::error(llvm::errs(), argv[0])
+              << toString(std::move(Err)) << '\n';
+          delete cg;
+          delete lexer;
+          return 1;
+        }
+
+        {
+          // The whole file is in one module now, so interprocedural passes
+          // such as the inliner and IPSCCP see every definition.
+          TimeRegion Region(TimePhases ? &OptTimer : nullptr);
+          Optimizer Opt(OptLevel, TheTargetMachine);
+          Opt.run(MyModule);
+        }
         
-        if(!emit(argv[0], MyModule, *TheTargetMachine, InputFilename)){
-          llvm::WithColor::error(llvm::errs(), argv[0]) << "Error writing output\n";
+        {
+          TimeRegion Region(TimePhases ? &EmitTimer : nullptr);
+          if(!emit(argv[0], MyModule, *TheTargetMachine, InputFilename)){
+            llvm::WithColor::error(llvm::errs(), argv[0]) << "Error writing output\n";
+          }
         }
         
         delete cg;
+        delete lexer;
     } else{ // JIT
         InitializeNativeTarget();
         InitializeNativeTargetAsmPrinter();
@@ -220,13 +534,46 @@ int main(int argc, char *argv[])
         //auto &MyModule = *TheModule;
         
         Lexer* lexer = new LexerSimple();
-        auto jit = new JITVisitor(std::move(TheContext), std::move(TheModule),
-                        OptLevel?1:0);
-        auto parser = Parser(lexer, jit, true);
+        OperatorTable Operators;
+        ExitOnError ExitOnErr("Kaleidoscope: ");
+        auto JTMB = ExitOnErr(getJITTargetMachineBuilder());
+        std::unique_ptr<DiskObjectCache> Cache;
+        if (!ObjectCacheDir.empty())
+          Cache = ExitOnErr(DiskObjectCache::create(
+              ObjectCacheDir, (uint64_t)ObjectCacheSize << 20,
+              getObjectCacheSalt(JTMB)));
+        auto jit = new JITVisitor(Operators, std::move(TheContext),
+                        std::move(TheModule), OptLevel, std::move(JTMB),
+                        getFPOptions(), Cache.get());
+        jit->setRemarks(Remarks);
+        jit->setExprSharing(HashCons);
+        if (Tiered && LazyJIT) {
+          llvm::WithColor::error(llvm::errs(), argv[0])
+              << "-tiered and -lazy cannot be combined\n";
+          return 1;
+        }
+        jit->setLazy(LazyJIT);
+        jit->setBatch(BatchSize);
+        jit->setPrintIR(PrintIR);
+        jit->setPrintResults(BatchSize <= 1 || PrintResults);
+        if (Tiered)
+          jit->setTiered(TierThreshold);
+        auto parser = Parser(lexer, Operators, jit, true);
+        parser.setHashConsing(HashCons);
+        ASTSimplifier Simplifier(parser.getContext(), lexer->getSymbols());
+        if (Remarks)
+          Simplifier.enableRemarks(nullptr);
+        if (Simplify)
+          parser.addPass(&Simplifier);
         parser.parse(); 
+        jit->flush();
 
+        if (JITMemoryStats)
+          jit->getMemoryPool().printStats(llvm::errs());
         delete jit;
         delete lexer;
+        if (Cache && ObjectCacheStats)
+          Cache->printStats(llvm::errs());
     }
     return 0;
 }
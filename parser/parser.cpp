@@ -1,47 +1,54 @@
 #include "../include/lexer.h"
 #include "../include/parser.h"
+#include "../include/tokens.h"
 #include "../include/AST.h"
 #include "../include/codegen.h"
 #include "llvm/Support/raw_ostream.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/ADT/SmallVector.h"
 #include <memory>
 
 using namespace Token;
 
-std::map<char, int> Parser::BinopPrecedence = Parser::InitBinopPrecedence();
-std::map<char, int> Parser::InitBinopPrecedence() {
-  std::map<char, int> Temp;
-  Temp['='] = 2;
-  Temp['<'] = 10;
-  Temp['+'] = 20;
-  Temp['-'] = 20;
-  Temp['*'] = 40; // highest.
-  return Temp;
-}
+Parser::Parser(TokenStream& tokens, OperatorTable& operators,
+               ASTVisitor* visitor, bool isJit)
+        :lexer(&tokens.getLexer()), Tokens(&tokens), Operators(operators),
+        Visitor(visitor), IsJit(isJit) {}
 
 int Parser::getNextToken() {
+    if (Tokens) {
+      // The stream ends with tok_eof; stay on it once it has been reached.
+      if (NextTokIdx < Tokens->size())
+        TokIdx = NextTokIdx++;
+      CurTok = Tokens->getKind(TokIdx);
+      return CurTok;
+    }
     CurTok = lexer->gettok();
     return CurTok;
 }
 
-int Parser::GetTokPrecedence() {
-  if (!isascii(CurTok))
-    return -1;
+double Parser::getNumVal() {
+    return Tokens ? Tokens->getNumVal(TokIdx) : lexer->NumVal;
+}
+
+Symbol Parser::getIdentifier() {
+    return Tokens ? Tokens->getIdentifier(TokIdx) : lexer->getIdentifier();
+}
 
+llvm::SMLoc Parser::getLocation() {
+    return Tokens ? Tokens->getLocation(TokIdx) : lexer->getLocation();
+}
+
+int Parser::GetTokPrecedence() {
   // Make sure it's a declared binop.
-  int TokPrec = BinopPrecedence[CurTok];
+  int TokPrec = Operators.getBinaryPrecedence(CurTok);
   if (TokPrec <= 0)
     return -1;
   return TokPrec;
 }
 
-std::unique_ptr<ExprAST> Parser::LogError(const char *Str) {
-  llvm::SMLoc Loc = lexer->getLocation();
-  if(Loc.isValid()){
-    llvm::SourceMgr &SrcMgr = (static_cast<LexerFile*>(lexer))->getSourceMgr();
-    SrcMgr.PrintMessage(Loc, llvm::SourceMgr::DiagKind::DK_Error, Str);
-  } else{
-    llvm::errs() << "Error: " << Str << "\n";
-  }
+ExprAST *Parser::LogError(const char *Str) {
+  lexer->printError(getLocation(), Str);
   return nullptr;
 }
 
@@ -51,14 +58,14 @@ std::unique_ptr<PrototypeAST> Parser::LogErrorP(const char *Str) {
 }
 
 
-std::unique_ptr<ExprAST> Parser::ParseNumberExpr() {
-  auto Result = std::make_unique<NumberExprAST>(lexer->NumVal, lexer->getLocation());
+ExprAST *Parser::ParseNumberExpr() {
+  auto Result = Context.getNumber(getNumVal(), getLocation());
   getNextToken(); // consume the number
-  return std::move(Result);
+  return Result;
 }
 
 /// parenexpr ::= '(' expression ')'
-std::unique_ptr<ExprAST> Parser::ParseParenExpr() {
+ExprAST *Parser::ParseParenExpr() {
   getNextToken(); // eat (.
   auto V = ParseExpression();
   if (!V)
@@ -73,21 +80,21 @@ std::unique_ptr<ExprAST> Parser::ParseParenExpr() {
 /// identifierexpr
 ///   ::= identifier
 ///   ::= identifier '(' expression* ')'
-std::unique_ptr<ExprAST> Parser::ParseIdentifierExpr() {
-  std::string IdName = lexer->IdentifierStr;
-  llvm::SMLoc Loc = lexer->getLocation();
+ExprAST *Parser::ParseIdentifierExpr() {
+  Symbol IdName = getIdentifier();
+  llvm::SMLoc Loc = getLocation();
   getNextToken(); // eat identifier.
 
   if (CurTok != '(') // Simple variable ref.
-    return std::make_unique<VariableExprAST>(IdName, Loc);
+    return Context.getVariable(IdName, Loc);
 
   // Call.
   getNextToken(); // eat (
-  std::vector<std::unique_ptr<ExprAST>> Args;
+  llvm::SmallVector<ExprAST *, 8> Args;
   if (CurTok != ')') {
     while (true) {
       if (auto Arg = ParseExpression())
-        Args.push_back(std::move(Arg));
+        Args.push_back(Arg);
       else
         return nullptr;
 
@@ -103,11 +110,12 @@ std::unique_ptr<ExprAST> Parser::ParseIdentifierExpr() {
   // Eat the ')'.
   getNextToken();
 
-  return std::make_unique<CallExprAST>(IdName, std::move(Args), lexer->getLocation());
+  return Context.create<CallExprAST>(
+      IdName, Context.copyArray(llvm::makeArrayRef(Args)), getLocation());
 }
 
 /// ifexpr ::= 'if' expression 'then' expression 'else' expression
-std::unique_ptr<ExprAST> Parser::ParseIfExpr() {
+ExprAST *Parser::ParseIfExpr() {
   getNextToken(); // eat the if.
  
   // condition.
@@ -132,18 +140,18 @@ std::unique_ptr<ExprAST> Parser::ParseIfExpr() {
   if (!Else)
     return nullptr;
 
-  return std::make_unique<IfExprAST>(std::move(Cond), std::move(Then),
-                                      std::move(Else), lexer->getLocation());
+  return Context.create<IfExprAST>(Cond, Then,
+                                      Else, getLocation());
 }
 
 /// forexpr ::= 'for' identifier '=' expr ',' expr (',' expr)? 'in' expression
-std::unique_ptr<ExprAST> Parser::ParseForExpr() {
+ExprAST *Parser::ParseForExpr() {
   getNextToken(); // eat the for.
 
   if (CurTok != tok_identifier)
     return LogError("expected identifier after for");
 
-  std::string IdName = lexer->IdentifierStr;
+  Symbol IdName = getIdentifier();
   getNextToken(); // eat identifier.
 
   if (CurTok != '=')
@@ -162,7 +170,7 @@ std::unique_ptr<ExprAST> Parser::ParseForExpr() {
     return nullptr;
 
   // The step value is optional.
-  std::unique_ptr<ExprAST> Step;
+  ExprAST *Step = nullptr;
   if (CurTok == ',') {
     getNextToken();
     Step = ParseExpression();
@@ -178,28 +186,28 @@ std::unique_ptr<ExprAST> Parser::ParseForExpr() {
   if (!Body)
     return nullptr;
 
-  return std::make_unique<ForExprAST>(IdName, std::move(Start), std::move(End),
-                                       std::move(Step), std::move(Body),
-                                       lexer->getLocation());
+  return Context.create<ForExprAST>(IdName, Start, End,
+                                       Step, Body,
+                                       getLocation());
 }
 
 /// varexpr ::= 'var' identifier ('=' expression)?
 //                    (',' identifier ('=' expression)?)* 'in' expression
-std::unique_ptr<ExprAST> Parser::ParseVarExpr() {
+ExprAST *Parser::ParseVarExpr() {
   getNextToken(); // eat the var.
 
-  std::vector<std::pair<std::string, std::unique_ptr<ExprAST>>> VarNames;
+  llvm::SmallVector<std::pair<Symbol, ExprAST *>, 4> VarNames;
 
   // At least one variable name is required.
   if (CurTok != tok_identifier)
     return LogError("expected identifier after var");
 
   while (true) {
-    std::string Name = lexer->IdentifierStr;
+    Symbol Name = getIdentifier();
     getNextToken(); // eat identifier.
 
     // Read the optional initializer.
-    std::unique_ptr<ExprAST> Init = nullptr;
+    ExprAST *Init = nullptr;
     if (CurTok == '=') {
       getNextToken(); // eat the '='.
 
@@ -208,7 +216,7 @@ std::unique_ptr<ExprAST> Parser::ParseVarExpr() {
         return nullptr;
     }
 
-    VarNames.push_back(std::make_pair(Name, std::move(Init)));
+    VarNames.push_back(std::make_pair(Name, Init));
 
     // End of var list, exit loop.
     if (CurTok != ',')
@@ -228,8 +236,8 @@ std::unique_ptr<ExprAST> Parser::ParseVarExpr() {
   if (!Body)
     return nullptr;
 
-  return std::make_unique<VarExprAST>(std::move(VarNames), std::move(Body),
-                  lexer->getLocation());
+  return Context.create<VarExprAST>(
+      Context.copyArray(llvm::makeArrayRef(VarNames)), Body, getLocation());
 }
 
 /// primary
@@ -239,7 +247,7 @@ std::unique_ptr<ExprAST> Parser::ParseVarExpr() {
 ///   ::= ifexpr
 ///   ::= forexpr
 ///   ::= varexpr
-std::unique_ptr<ExprAST> Parser::ParsePrimary() {
+ExprAST *Parser::ParsePrimary() {
   switch (CurTok) {
   default:
     return LogError("unknown token when expecting an expression");
@@ -247,6 +255,9 @@ std::unique_ptr<ExprAST> Parser::ParsePrimary() {
     return ParseIdentifierExpr();
   case tok_number:
     return ParseNumberExpr();
+  case tok_error:
+    // The lexer has reported it.
+    return nullptr;
   case '(':
     return ParseParenExpr();
   case tok_if:
@@ -261,66 +272,108 @@ std::unique_ptr<ExprAST> Parser::ParsePrimary() {
 /// unary
 ///   ::= primary
 ///   ::= '!' unary
-std::unique_ptr<ExprAST> Parser::ParseUnary() {
+///
+/// The chain of prefix operators is collected in a loop rather than by
+/// recursion, so '- - - ... x' needs no stack per operator.
+ExprAST *Parser::ParseUnary() {
+  llvm::SmallVector<std::pair<int, llvm::SMLoc>, 4> Prefix;
   // If the current token is not an operator, it must be a primary expr.
-  if (!isascii(CurTok) || CurTok == '(' || CurTok == ',')
-    return ParsePrimary();
+  while (isascii(CurTok) && CurTok != '(' && CurTok != ',') {
+    // If this is a unary operator, read it.
+    Prefix.push_back({CurTok, getLocation()});
+    getNextToken();
+  }
 
-  // If this is a unary operator, read it.
-  int Opc = CurTok;
-  getNextToken();
-  if (auto Operand = ParseUnary())
-    return std::make_unique<UnaryExprAST>(Opc, std::move(Operand), lexer->getLocation());
-  return nullptr;
+  ExprAST *Operand = ParsePrimary();
+  if (!Operand)
+    return nullptr;
+  for (auto &Op : llvm::reverse(Prefix)) {
+    if (isBuiltinUnaryOp(Op.first) && Operators.isUserUnary(Op.first))
+      Operand = CreateOperatorCall("unary", Op.first, Operand, Op.second);
+    else
+      Operand = Context.create<UnaryExprAST>(Op.first, Operand, Op.second);
+  }
+  return Operand;
+}
+
+/// CreateOperatorCall - A call of the user's definition of a builtin
+/// operator, which replaces the builtin from then on.
+ExprAST *Parser::CreateOperatorCall(const char *Kind, int Op,
+                                    llvm::ArrayRef<ExprAST *> Args,
+                                    llvm::SMLoc Loc) {
+  std::string FnName = Kind;
+  FnName += (char)Op;
+  return Context.create<CallExprAST>(lexer->getSymbols().intern(FnName),
+                                     Context.copyArray(Args), Loc);
 }
 
 /// binoprhs
 ///   ::= ('+' unary)*
-std::unique_ptr<ExprAST> Parser::ParseBinOpRHS(int ExprPrec,
-                                              std::unique_ptr<ExprAST> LHS) {
-  // If this is a binop, find its precedence.
+///
+/// Operator precedence parsing with explicit operand and operator stacks:
+/// an operator is reduced as soon as one that binds no tighter follows it,
+/// which makes equal precedence left associative.  The stack depth does not
+/// grow with the length of the chain, and each operator is pushed and
+/// reduced exactly once.
+ExprAST *Parser::ParseBinOpRHS(int ExprPrec, ExprAST *LHS) {
+  struct PendingOp {
+    int Op;
+    int Prec;
+    llvm::SMLoc Loc;
+  };
+  llvm::SmallVector<ExprAST *, 8> Operands;
+  llvm::SmallVector<PendingOp, 8> Ops;
+  Operands.push_back(LHS);
+
+  auto Reduce = [&] {
+    PendingOp Op = Ops.pop_back_val();
+    ExprAST *RHS = Operands.pop_back_val();
+    if (isPureBinaryOp(Op.Op) && Operators.isUserBinary(Op.Op))
+      Operands.back() = CreateOperatorCall(
+          "binary", Op.Op, {Operands.back(), RHS}, Op.Loc);
+    else
+      Operands.back() =
+          Context.getBinary(Op.Op, Operands.back(), RHS, Op.Loc);
+  };
+
   while (true) {
     int TokPrec = GetTokPrecedence();
 
     // If this is a binop that binds at least as tightly as the current binop,
     // consume it, otherwise we are done.
     if (TokPrec < ExprPrec)
-      return LHS;
+      break;
+
+    // Everything pending that binds at least as tightly as this operator is
+    // complete.
+    while (!Ops.empty() && Ops.back().Prec >= TokPrec)
+      Reduce();
 
     // Okay, we know this is a binop.
-    int BinOp = CurTok;
+    Ops.push_back({CurTok, TokPrec, getLocation()});
     getNextToken(); // eat binop
 
     // Parse the unary expression after the binary operator.
     auto RHS = ParseUnary();
     if (!RHS)
       return nullptr;
-
-    // If BinOp binds less tightly with RHS than the operator after RHS, let
-    // the pending operator take RHS as its LHS.
-    int NextPrec = GetTokPrecedence();
-    if (TokPrec < NextPrec) {
-      RHS = ParseBinOpRHS(TokPrec + 1, std::move(RHS));
-      if (!RHS)
-        return nullptr;
-    }
-
-    // Merge LHS/RHS.
-    LHS =
-        std::make_unique<BinaryExprAST>(BinOp, std::move(LHS), std::move(RHS),
-                        lexer->getLocation());
+    Operands.push_back(RHS);
   }
+
+  while (!Ops.empty())
+    Reduce();
+  return Operands.back();
 }
 
 /// expression
 ///   ::= unary binoprhs
 ///
-std::unique_ptr<ExprAST> Parser::ParseExpression() {
+ExprAST *Parser::ParseExpression() {
   auto LHS = ParseUnary();
   if (!LHS)
     return nullptr;
 
-  return ParseBinOpRHS(0, std::move(LHS));
+  return ParseBinOpRHS(0, LHS);
 }
 
 /// prototype
@@ -329,6 +382,7 @@ std::unique_ptr<ExprAST> Parser::ParseExpression() {
 ///   ::= unary LETTER (id)
 std::unique_ptr<PrototypeAST> Parser::ParsePrototype() {
   std::string FnName;
+  Symbol FnSym;
 
   unsigned Kind = 0; // 0 = identifier, 1 = unary, 2 = binary.
   unsigned BinaryPrecedence = 30;
@@ -337,7 +391,7 @@ std::unique_ptr<PrototypeAST> Parser::ParsePrototype() {
   default:
     return LogErrorP("Expected function name in prototype");
   case tok_identifier:
-    FnName = lexer->IdentifierStr;
+    FnSym = getIdentifier();
     Kind = 0;
     getNextToken();
     break;
@@ -354,6 +408,8 @@ std::unique_ptr<PrototypeAST> Parser::ParsePrototype() {
     getNextToken();
     if (!isascii(CurTok))
       return LogErrorP("Expected binary operator");
+    if (CurTok == '=')
+      return LogErrorP("'=' is assignment and cannot be redefined");
     FnName = "binary";
     FnName += (char)CurTok;
     Kind = 2;
@@ -361,9 +417,9 @@ std::unique_ptr<PrototypeAST> Parser::ParsePrototype() {
 
     // Read the precedence if present.
     if (CurTok == tok_number) {
-      if (lexer->NumVal < 1 || lexer->NumVal > 100)
+      if (getNumVal() < 1 || getNumVal() > 100)
         return LogErrorP("Invalid precedence: must be 1..100");
-      BinaryPrecedence = (unsigned)lexer->NumVal;
+      BinaryPrecedence = (unsigned)getNumVal();
       getNextToken();
     }
     break;
@@ -372,9 +428,9 @@ std::unique_ptr<PrototypeAST> Parser::ParsePrototype() {
   if (CurTok != '(')
     return LogErrorP("Expected '(' in prototype");
 
-  std::vector<std::string> ArgNames;
+  std::vector<Symbol> ArgNames;
   while (getNextToken() == tok_identifier)
-    ArgNames.push_back(lexer->IdentifierStr);
+    ArgNames.push_back(getIdentifier());
   if (CurTok != ')')
     return LogErrorP("Expected ')' in prototype");
 
@@ -385,7 +441,9 @@ std::unique_ptr<PrototypeAST> Parser::ParsePrototype() {
   if (Kind && ArgNames.size() != Kind)
     return LogErrorP("Invalid number of operands for operator");
 
-  return std::make_unique<PrototypeAST>(FnName, ArgNames, Kind != 0,
+  if (Kind)
+    FnSym = lexer->getSymbols().intern(FnName);
+  return std::make_unique<PrototypeAST>(FnSym, std::move(ArgNames), Kind != 0,
                                          BinaryPrecedence);
 }
 
@@ -397,7 +455,7 @@ std::unique_ptr<FunctionAST> Parser::ParseDefinition() {
     return nullptr;
   
   if (auto E = ParseExpression())
-    return std::make_unique<FunctionAST>(std::move(Proto), std::move(E));
+    return std::make_unique<FunctionAST>(std::move(Proto), E);
   return nullptr;
 }
 
@@ -405,9 +463,10 @@ std::unique_ptr<FunctionAST> Parser::ParseDefinition() {
 std::unique_ptr<FunctionAST> Parser::ParseTopLevelExpr() {
   if (auto E = ParseExpression()) {
     // Make an anonymous proto.
-    auto Proto = std::make_unique<PrototypeAST>(IsJit?"__anon_expr":"main",
-                                                 std::vector<std::string>());
-    return std::make_unique<FunctionAST>(std::move(Proto), std::move(E));
+    auto Proto = std::make_unique<PrototypeAST>(
+        lexer->getSymbols().intern(IsJit?"__anon_expr":"main"),
+        std::vector<Symbol>());
+    return std::make_unique<FunctionAST>(std::move(Proto), E);
   }
   return nullptr;
 }
@@ -421,8 +480,15 @@ std::unique_ptr<PrototypeAST> Parser::ParseExtern() {
 
 void Parser::HandleDefinition() {
     if(auto FnAST = ParseDefinition()) {
-        FnAST->accept(*Visitor);
+        for (ASTVisitor *Pass : Passes)
+            FnAST->accept(*Pass);
+        if (!FnAST->accept(*Visitor))
+            for (ASTVisitor *Pass : Passes)
+                Pass->definitionRejected();
+        // The body is dead once it has been code generated.
+        Context.reset();
     }else{
+        Context.reset();
         getNextToken();
     }
 }
@@ -439,10 +505,14 @@ void Parser::HandleExtern() {
 
 void Parser::HandleTopLevelExpression() {
     if(auto FnAST = ParseTopLevelExpr()) {
+        for (ASTVisitor *Pass : Passes)
+            FnAST->accept(*Pass);
         if(FnAST->accept(*Visitor)) {
               
         }
+        Context.reset();
     }else{
+        Context.reset();
         getNextToken();
     }
 }
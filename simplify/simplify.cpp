@@ -0,0 +1,509 @@
+#include "../include/simplify.h"
+#include "llvm/ADT/STLExtras.h"
+#include "llvm/Support/Casting.h"
+#include "llvm/Support/ErrorHandling.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <cmath>
+#include <string>
+
+using namespace llvm;
+
+/// isPure - Whether evaluating E can neither have side effects nor observe
+/// one, so it may be duplicated, dropped or moved past other operands.
+static bool isPure(ExprAST *E) {
+  // Left operands are followed in a loop, right ones recursively, so long
+  // chains like a + b + c do not recurse once per operator.
+  while (auto *B = dyn_cast<BinaryExprAST>(E)) {
+    if (!isPureBinaryOp(B->Op) || !isPure(B->RHS))
+      return false;
+    E = B->LHS;
+  }
+  return isa<NumberExprAST>(E) || isa<VariableExprAST>(E);
+}
+
+/// isInlinable - Whether E is small enough to be inlined and only made of
+/// nodes that do not bind or assign variables, so substituting operands
+/// into it can neither capture nor clobber anything.  Budget is decremented
+/// by the number of nodes visited.
+static bool isInlinable(ExprAST *E, unsigned &Budget) {
+  if (Budget == 0)
+    return false;
+  --Budget;
+  switch (E->getKind()) {
+  case ExprAST::EK_Number:
+  case ExprAST::EK_Variable:
+    return true;
+  case ExprAST::EK_Unary:
+    return isInlinable(cast<UnaryExprAST>(E)->Operand, Budget);
+  case ExprAST::EK_Binary: {
+    auto *B = cast<BinaryExprAST>(E);
+    return B->Op != '=' && isInlinable(B->LHS, Budget) &&
+           isInlinable(B->RHS, Budget);
+  }
+  case ExprAST::EK_Call:
+    for (ExprAST *Arg : cast<CallExprAST>(E)->Args)
+      if (!isInlinable(Arg, Budget))
+        return false;
+    return true;
+  default:
+    return false;
+  }
+}
+
+/// isSelfContained - Whether the only variables E reads are Params and it
+/// does not call Self, so that its copy means the same thing wherever it is
+/// substituted and expanding it terminates.
+static bool isSelfContained(ExprAST *E, llvm::ArrayRef<Symbol> Params,
+                            Symbol Self) {
+  switch (E->getKind()) {
+  case ExprAST::EK_Number:
+    return true;
+  case ExprAST::EK_Variable:
+    return is_contained(Params, cast<VariableExprAST>(E)->Name);
+  case ExprAST::EK_Unary:
+    return isSelfContained(cast<UnaryExprAST>(E)->Operand, Params, Self);
+  case ExprAST::EK_Binary: {
+    auto *B = cast<BinaryExprAST>(E);
+    return isSelfContained(B->LHS, Params, Self) &&
+           isSelfContained(B->RHS, Params, Self);
+  }
+  case ExprAST::EK_Call: {
+    auto *C = cast<CallExprAST>(E);
+    if (C->Callee == Self)
+      return false;
+    for (ExprAST *Arg : C->Args)
+      if (!isSelfContained(Arg, Params, Self))
+        return false;
+    return true;
+  }
+  default:
+    return false;
+  }
+}
+
+/// countUses - Number of reads of Name in the inlinable expression E.
+static unsigned countUses(ExprAST *E, Symbol Name) {
+  switch (E->getKind()) {
+  case ExprAST::EK_Variable:
+    return cast<VariableExprAST>(E)->Name == Name;
+  case ExprAST::EK_Unary:
+    return countUses(cast<UnaryExprAST>(E)->Operand, Name);
+  case ExprAST::EK_Binary: {
+    auto *B = cast<BinaryExprAST>(E);
+    return countUses(B->LHS, Name) + countUses(B->RHS, Name);
+  }
+  case ExprAST::EK_Call: {
+    unsigned Uses = 0;
+    for (ExprAST *Arg : cast<CallExprAST>(E)->Args)
+      Uses += countUses(Arg, Name);
+    return Uses;
+  }
+  default:
+    return 0;
+  }
+}
+
+/// clone - Deep copy the inlinable expression E into Ctx.
+static ExprAST *clone(ASTContext &Ctx, ExprAST *E) {
+  switch (E->getKind()) {
+  case ExprAST::EK_Number: {
+    auto *N = cast<NumberExprAST>(E);
+    return Ctx.create<NumberExprAST>(N->Val, N->getLocation());
+  }
+  case ExprAST::EK_Variable: {
+    auto *V = cast<VariableExprAST>(E);
+    return Ctx.create<VariableExprAST>(V->Name, V->getLocation());
+  }
+  case ExprAST::EK_Unary: {
+    auto *U = cast<UnaryExprAST>(E);
+    return Ctx.create<UnaryExprAST>(U->Opcode, clone(Ctx, U->Operand),
+                                    U->getLocation());
+  }
+  case ExprAST::EK_Binary: {
+    auto *B = cast<BinaryExprAST>(E);
+    return Ctx.create<BinaryExprAST>(B->Op, clone(Ctx, B->LHS),
+                                     clone(Ctx, B->RHS), B->getLocation());
+  }
+  case ExprAST::EK_Call: {
+    auto *C = cast<CallExprAST>(E);
+    SmallVector<ExprAST *, 8> Args;
+    for (ExprAST *Arg : C->Args)
+      Args.push_back(clone(Ctx, Arg));
+    return Ctx.create<CallExprAST>(C->Callee,
+                                   Ctx.copyArray(makeArrayRef(Args)),
+                                   C->getLocation());
+  }
+  default:
+    llvm_unreachable("not an inlinable expression");
+  }
+}
+
+/// isTrue - Whether Val counts as true in a condition: non-zero and not NaN.
+static bool isTrue(double Val) { return !std::isnan(Val) && Val != 0.0; }
+
+Symbol ASTSimplifier::getFreshName() {
+  if (NextFresh == FreshNames.size())
+    FreshNames.push_back(
+        Symbols.intern(".inl" + std::to_string(FreshNames.size())));
+  return FreshNames[NextFresh++];
+}
+
+void ASTSimplifier::remark(llvm::SMLoc Loc, const llvm::Twine &Msg) {
+  if (SrcMgr && Loc.isValid())
+    SrcMgr->PrintMessage(Loc, SourceMgr::DK_Remark, Msg);
+  else
+    errs() << "remark: " << Msg << "\n";
+}
+
+ExprAST *ASTSimplifier::simplify(ExprAST *E) {
+  E->accept(*this);
+  return Result;
+}
+
+ExprAST *ASTSimplifier::buildUnary(char Op, ExprAST *Operand,
+                                   llvm::SMLoc Loc, UnaryExprAST *Orig) {
+  if (isBuiltinUnaryOp(Op)) {
+    if (auto *N = dyn_cast<NumberExprAST>(Operand))
+      return Context.getNumber(isTrue(N->Val) ? 0.0 : 1.0, Loc);
+    if (Orig && Orig->Operand == Operand)
+      return Orig;
+    return Context.create<UnaryExprAST>(Op, Operand, Loc);
+  }
+
+  const InlineOp &Entry = UnaryOps[(unsigned char)Op];
+  if (Entry.Body && !Inlining.count(&Entry))
+    return inlineOp(Entry, Operand, Loc);
+  if (Orig && Orig->Operand == Operand)
+    return Orig;
+  return Context.create<UnaryExprAST>(Op, Operand, Loc);
+}
+
+ExprAST *ASTSimplifier::buildBinary(char Op, ExprAST *LHS, ExprAST *RHS,
+                                    llvm::SMLoc Loc, BinaryExprAST *Orig) {
+  bool Unchanged = Orig && Orig->LHS == LHS && Orig->RHS == RHS;
+
+  if (!isPureBinaryOp(Op)) {
+    // '=' is always an assignment, whatever the user defined.
+    const InlineOp &Entry = BinaryOps[(unsigned char)Op];
+    if (Op != '=' && Entry.Body && !Inlining.count(&Entry)) {
+      ExprAST *Args[] = {LHS, RHS};
+      return inlineOp(Entry, Args, Loc);
+    }
+    if (Unchanged)
+      return Orig;
+    return Context.create<BinaryExprAST>(Op, LHS, RHS, Loc);
+  }
+
+  auto *L = dyn_cast<NumberExprAST>(LHS);
+  auto *R = dyn_cast<NumberExprAST>(RHS);
+
+  // A literal left operand that decides a logical operator makes the right
+  // one dead.
+  if (L && ((Op == BinOp::And && !isTrue(L->Val)) ||
+            (Op == BinOp::Or && isTrue(L->Val))))
+    return Context.getNumber(Op == BinOp::Or ? 1.0 : 0.0, Loc);
+
+  if (L && R) {
+    double Val;
+    switch (Op) {
+    case '+': Val = L->Val + R->Val; break;
+    case '-': Val = L->Val - R->Val; break;
+    case '*': Val = L->Val * R->Val; break;
+    case '/': Val = L->Val / R->Val; break;
+    // Codegen uses unordered compares, which are true for NaN operands,
+    // except for '=='.
+    case '<': Val = !(L->Val >= R->Val); break;
+    case '>': Val = !(L->Val <= R->Val); break;
+    case BinOp::LE: Val = !(L->Val > R->Val); break;
+    case BinOp::GE: Val = !(L->Val < R->Val); break;
+    case BinOp::EQ: Val = L->Val == R->Val; break;
+    case BinOp::NE: Val = L->Val != R->Val; break;
+    case BinOp::And:
+    case BinOp::Or: Val = isTrue(R->Val); break;
+    default: llvm_unreachable("unknown builtin operator");
+    }
+    return Context.getNumber(Val, Loc);
+  }
+
+  // Only identities that hold for every double, signed zeros and NaNs
+  // included: x+0 is not one of them (-0+0 is +0), nor is x*0.
+  if (Op == '*' && R && R->Val == 1.0)
+    return LHS;
+  if (Op == '*' && L && L->Val == 1.0)
+    return RHS;
+  if (Op == '/' && R && R->Val == 1.0)
+    return LHS;
+  if (Op == '-' && R && R->Val == 0.0 && !std::signbit(R->Val))
+    return LHS;
+  if (Op == '+' && R && R->Val == 0.0 && std::signbit(R->Val))
+    return LHS;
+  if (Op == '+' && L && L->Val == 0.0 && std::signbit(L->Val))
+    return RHS;
+
+  return Unchanged ? Orig : Context.getBinary(Op, LHS, RHS, Loc);
+}
+
+ExprAST *ASTSimplifier::buildIf(ExprAST *Cond, ExprAST *Then, ExprAST *Else,
+                                llvm::SMLoc Loc, IfExprAST *Orig) {
+  // The condition is tested with an ordered compare against 0.0, so a NaN
+  // literal selects the else arm.
+  if (auto *C = dyn_cast<NumberExprAST>(Cond))
+    return !std::isnan(C->Val) && C->Val != 0.0 ? Then : Else;
+  if (Orig && Orig->Cond == Cond && Orig->Then == Then && Orig->Else == Else)
+    return Orig;
+  return Context.create<IfExprAST>(Cond, Then, Else, Loc);
+}
+
+ExprAST *ASTSimplifier::buildCall(Symbol Callee,
+                                  llvm::ArrayRef<ExprAST *> Args,
+                                  llvm::SMLoc Loc, CallExprAST *Orig) {
+  auto It = Functions.find(Callee);
+  // A call with the wrong number of arguments is left for codegen to
+  // diagnose.
+  if (It != Functions.end() && It->second.Params.size() == Args.size() &&
+      !Inlining.count(&It->second))
+    return inlineOp(It->second, Args, Loc);
+  if (Orig && makeArrayRef(Orig->Args) == Args)
+    return Orig;
+  return Context.create<CallExprAST>(Callee,
+                                     Context.copyArray(makeArrayRef(Args)),
+                                     Loc);
+}
+
+/// inlineOp - Expand Op applied to Args.  The operands of the call are
+/// all evaluated, once and in order, before the body runs.  An operand is
+/// substituted into the body only where that is indistinguishable; the
+/// others are bound to fresh variables, in order, around the body.
+ExprAST *ASTSimplifier::inlineOp(const InlineOp &Op,
+                                 llvm::ArrayRef<ExprAST *> Args,
+                                 llvm::SMLoc Loc) {
+  SmallVector<bool, 2> Pure;
+  int LastImpure = -1;
+  for (unsigned i = 0, e = Args.size(); i != e; ++i) {
+    Pure.push_back(isPure(Args[i]));
+    if (!Pure.back())
+      LastImpure = i;
+  }
+  auto *BodyVar = dyn_cast<VariableExprAST>(Op.Body);
+
+  SmallVector<ExprAST *, 2> Operands;
+  SmallVector<std::pair<Symbol, ExprAST *>, 2> Bindings;
+  for (unsigned i = 0, e = Args.size(); i != e; ++i) {
+    ExprAST *Arg = Args[i];
+    bool Substitute;
+    if (isa<NumberExprAST>(Arg) || (Pure[i] && Op.Uses[i] == 0))
+      Substitute = true;
+    else if (Pure[i])
+      // A later operand could assign to a variable this one reads.
+      // Duplicating anything but a plain read would duplicate work.
+      Substitute = (int)i > LastImpure &&
+                   (isa<VariableExprAST>(Arg) || Op.Uses[i] == 1);
+    else
+      // A body that just returns the last operand with side effects
+      // evaluates it at the same point the call would have.
+      Substitute = (int)i == LastImpure && BodyVar &&
+                   BodyVar->Name == Op.Params[i];
+    if (Substitute) {
+      Operands.push_back(Arg);
+      continue;
+    }
+    Symbol Name = getFreshName();
+    Bindings.push_back({Name, Arg});
+    Operands.push_back(Context.getVariable(Name, Loc));
+  }
+
+  if (Remarks)
+    remark(Loc, "inlined '" + Op.Name.str() + "' into '" +
+                    CurFunction.str() + "'");
+
+  Inlining.insert(&Op);
+  ExprAST *Body = substitute(Op.Body, Op.Params, Operands);
+  Inlining.erase(&Op);
+
+  if (Bindings.empty())
+    return Body;
+  return Context.create<VarExprAST>(
+      Context.copyArray(makeArrayRef(Bindings)), Body, Loc);
+}
+
+/// substitute - Instantiate the stored operator body E in the parser's
+/// arena with Params replaced by Args, folding as it goes.
+ExprAST *ASTSimplifier::substitute(ExprAST *E, llvm::ArrayRef<Symbol> Params,
+                                   llvm::ArrayRef<ExprAST *> Args) {
+  switch (E->getKind()) {
+  case ExprAST::EK_Number: {
+    auto *N = cast<NumberExprAST>(E);
+    return Context.getNumber(N->Val, N->getLocation());
+  }
+  case ExprAST::EK_Variable: {
+    auto *V = cast<VariableExprAST>(E);
+    for (unsigned i = 0, e = Params.size(); i != e; ++i)
+      if (Params[i] == V->Name)
+        return Args[i];
+    return Context.getVariable(V->Name, V->getLocation());
+  }
+  case ExprAST::EK_Unary: {
+    auto *U = cast<UnaryExprAST>(E);
+    return buildUnary(U->Opcode, substitute(U->Operand, Params, Args),
+                      U->getLocation());
+  }
+  case ExprAST::EK_Binary: {
+    auto *B = cast<BinaryExprAST>(E);
+    ExprAST *LHS = substitute(B->LHS, Params, Args);
+    ExprAST *RHS = substitute(B->RHS, Params, Args);
+    return buildBinary(B->Op, LHS, RHS, B->getLocation());
+  }
+  case ExprAST::EK_Call: {
+    auto *C = cast<CallExprAST>(E);
+    SmallVector<ExprAST *, 8> CallArgs;
+    for (ExprAST *Arg : C->Args)
+      CallArgs.push_back(substitute(Arg, Params, Args));
+    return buildCall(C->Callee, CallArgs, C->getLocation());
+  }
+  default:
+    llvm_unreachable("not an inlinable expression");
+  }
+}
+
+void ASTSimplifier::recordDefinition(PrototypeAST &Proto, ExprAST *Body) {
+  Recorded = nullptr;
+  // The parser turns uses of a redefined builtin operator into calls, so
+  // such definitions are recorded like functions.
+  bool IsCalled =
+      !Proto.IsOperator ||
+      (Proto.isUnaryOp() ? isBuiltinUnaryOp(Proto.getOperatorName())
+                         : isPureBinaryOp(Proto.getOperatorName()));
+  InlineOp &Entry =
+      IsCalled ? Functions[Proto.Name]
+      : Proto.isUnaryOp() ? UnaryOps[(unsigned char)Proto.getOperatorName()]
+                          : BinaryOps[(unsigned char)Proto.getOperatorName()];
+  // A redefinition replaces whatever we knew about the definition.
+  Entry.Body = nullptr;
+  Entry.Params.clear();
+  Entry.Uses.clear();
+
+  // Recursive definitions are left to codegen, which turns self tail calls
+  // into loops.
+  unsigned Budget = InlineThreshold;
+  if (!isInlinable(Body, Budget) ||
+      !isSelfContained(Body, Proto.Args, Proto.Name)) {
+    if (IsCalled)
+      Functions.erase(Proto.Name);
+    return;
+  }
+  Entry.Name = Proto.Name;
+  Entry.Params.assign(Proto.Args.begin(), Proto.Args.end());
+  for (Symbol Param : Entry.Params)
+    Entry.Uses.push_back(countUses(Body, Param));
+  Entry.Body = clone(OpContext, Body);
+  Recorded = &Entry;
+}
+
+Value *ASTSimplifier::visit(NumberExprAST &Node) {
+  Result = &Node;
+  return nullptr;
+}
+
+Value *ASTSimplifier::visit(VariableExprAST &Node) {
+  Result = &Node;
+  return nullptr;
+}
+
+Value *ASTSimplifier::visit(UnaryExprAST &Node) {
+  ExprAST *Operand = simplify(Node.Operand);
+  Result = buildUnary(Node.Opcode, Operand, Node.getLocation(), &Node);
+  return nullptr;
+}
+
+Value *ASTSimplifier::visit(BinaryExprAST &Node) {
+  // Simplify a left-deep chain like a + b + c bottom up in a loop rather
+  // than recursing once per operator.
+  SmallVector<BinaryExprAST *, 8> Spine = {&Node};
+  while (Spine.back()->Op != '=' && isa<BinaryExprAST>(Spine.back()->LHS))
+    Spine.push_back(cast<BinaryExprAST>(Spine.back()->LHS));
+
+  // Only the value stored by an assignment can be simplified.
+  BinaryExprAST *Innermost = Spine.back();
+  ExprAST *LHS =
+      Innermost->Op == '=' ? Innermost->LHS : simplify(Innermost->LHS);
+  for (BinaryExprAST *B : reverse(Spine)) {
+    ExprAST *RHS = simplify(B->RHS);
+    LHS = buildBinary(B->Op, LHS, RHS, B->getLocation(), B);
+  }
+  Result = LHS;
+  return nullptr;
+}
+
+Value *ASTSimplifier::visit(CallExprAST &Node) {
+  SmallVector<ExprAST *, 8> Args;
+  for (ExprAST *Arg : Node.Args)
+    Args.push_back(simplify(Arg));
+  Result = buildCall(Node.Callee, Args, Node.getLocation(), &Node);
+  return nullptr;
+}
+
+Value *ASTSimplifier::visit(IfExprAST &Node) {
+  ExprAST *Cond = simplify(Node.Cond);
+  if (auto *C = dyn_cast<NumberExprAST>(Cond)) {
+    // Dead arm: do not even look at it.
+    Result = simplify(!std::isnan(C->Val) && C->Val != 0.0 ? Node.Then
+                                                           : Node.Else);
+    return nullptr;
+  }
+  ExprAST *Then = simplify(Node.Then);
+  ExprAST *Else = simplify(Node.Else);
+  Result = buildIf(Cond, Then, Else, Node.getLocation(), &Node);
+  return nullptr;
+}
+
+Value *ASTSimplifier::visit(ForExprAST &Node) {
+  ExprAST *Start = simplify(Node.Start);
+  ExprAST *End = simplify(Node.End);
+  ExprAST *Step = Node.Step ? simplify(Node.Step) : nullptr;
+  ExprAST *Body = simplify(Node.Body);
+  if (Start == Node.Start && End == Node.End && Step == Node.Step &&
+      Body == Node.Body)
+    Result = &Node;
+  else
+    Result = Context.create<ForExprAST>(Node.VarName, Start, End, Step, Body,
+                                        Node.getLocation());
+  return nullptr;
+}
+
+Value *ASTSimplifier::visit(VarExprAST &Node) {
+  SmallVector<std::pair<Symbol, ExprAST *>, 4> VarNames;
+  bool Changed = false;
+  for (auto &Var : Node.VarNames) {
+    ExprAST *Init = Var.second ? simplify(Var.second) : nullptr;
+    VarNames.push_back({Var.first, Init});
+    Changed |= Init != Var.second;
+  }
+  ExprAST *Body = simplify(Node.Body);
+  if (!Changed && Body == Node.Body)
+    Result = &Node;
+  else
+    Result = Context.create<VarExprAST>(
+        Context.copyArray(makeArrayRef(VarNames)), Body, Node.getLocation());
+  return nullptr;
+}
+
+Function *ASTSimplifier::visit(FunctionAST &Node) {
+  NextFresh = 0;
+  CurFunction = Node.Proto->Name;
+  Node.Body = simplify(Node.Body);
+  recordDefinition(*Node.Proto, Node.Body);
+  return nullptr;
+}
+
+void ASTSimplifier::definitionRejected() {
+  // Code generation erased the function, so calls to it must fail again.
+  if (!Recorded)
+    return;
+  auto It = Functions.find(Recorded->Name);
+  if (It != Functions.end() && &It->second == Recorded)
+    Functions.erase(It);
+  else
+    Recorded->Body = nullptr;
+  Recorded = nullptr;
+}
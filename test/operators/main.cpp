@@ -0,0 +1,79 @@
+#include <cmath>
+#include <iostream>
+
+extern "C" {
+    double quotient(double, double);
+    double lessequal(double, double);
+    double greaterequal(double, double);
+    double equal(double, double);
+    double notequal(double, double);
+    double negation(double);
+    double conjunction(double, double);
+    double disjunction(double, double);
+    double precedence(double, double, double, double);
+    double greater(double, double);
+    double overridden(double);
+}
+
+#ifdef _WIN32
+#define DLLEXPORT __declspec(dllexport)
+#else
+#define DLLEXPORT
+#endif
+
+static int Touched = 0;
+
+extern "C" DLLEXPORT double touch(double X) {
+  ++Touched;
+  return X;
+}
+
+int main()
+{
+    const double NaN = std::nan("");
+
+    std::cout << "7 / 2 = " << quotient(7, 2) << std::endl;
+    std::cout << "1 / 0 = " << quotient(1, 0) << std::endl;
+    std::cout << "2 <= 2 = " << lessequal(2, 2) << std::endl;
+    std::cout << "3 >= 4 = " << greaterequal(3, 4) << std::endl;
+    std::cout << "2 == 2 = " << equal(2, 2) << std::endl;
+    std::cout << "2 != 2 = " << notequal(2, 2) << std::endl;
+
+    // Every comparison but '==' holds for NaN operands.
+    std::cout << "nan <= 1 = " << lessequal(NaN, 1) << std::endl;
+    std::cout << "1 >= nan = " << greaterequal(1, NaN) << std::endl;
+    std::cout << "nan == nan = " << equal(NaN, NaN) << std::endl;
+    std::cout << "nan != nan = " << notequal(NaN, NaN) << std::endl;
+
+    // NaN is false.
+    std::cout << "!0 = " << negation(0) << std::endl;
+    std::cout << "!2 = " << negation(2) << std::endl;
+    std::cout << "!nan = " << negation(NaN) << std::endl;
+
+    Touched = 0;
+    std::cout << "0 && 5 = " << conjunction(0, 5);
+    std::cout << " (right operand evaluated " << Touched << " times)" << std::endl;
+    Touched = 0;
+    std::cout << "nan && 5 = " << conjunction(NaN, 5);
+    std::cout << " (right operand evaluated " << Touched << " times)" << std::endl;
+    Touched = 0;
+    std::cout << "3 && nan = " << conjunction(3, NaN);
+    std::cout << " (right operand evaluated " << Touched << " times)" << std::endl;
+    Touched = 0;
+    std::cout << "3 || 0 = " << disjunction(3, 0);
+    std::cout << " (right operand evaluated " << Touched << " times)" << std::endl;
+    Touched = 0;
+    std::cout << "nan || 4 = " << disjunction(NaN, 4);
+    std::cout << " (right operand evaluated " << Touched << " times)" << std::endl;
+
+    std::cout << "1 && 0 || 2 == 2 = " << precedence(1, 0, 2, 2) << std::endl;
+
+    // The user's '>' and '!' replace the builtins.
+    Touched = 0;
+    std::cout << "3 > 2 = " << greater(3, 2);
+    std::cout << " (user definition called " << Touched << " times)" << std::endl;
+    Touched = 0;
+    std::cout << "!0 = " << overridden(0);
+    std::cout << " (user definition called " << Touched << " times)" << std::endl;
+    return 0;
+}